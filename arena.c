@@ -0,0 +1,74 @@
+#include <u.h>
+#include <libc.h>
+#include <thread.h>
+#include <draw.h>
+#include <memdraw.h>
+#include <geometry.h>
+#include "graphics.h"
+#include "internal.h"
+
+/*
+ * bump allocator.  memory is handed out from fixed-size blocks
+ * that never move, and it's all given back at once with
+ * _freearena.
+ */
+
+enum {
+	ARENAALIGN	= 8,
+};
+
+static Arenablk *
+allocarenablk(usize size)
+{
+	Arenablk *b;
+
+	b = _emalloc(sizeof(Arenablk) + size);
+	b->next = nil;
+	b->len = 0;
+	b->cap = size;
+	return b;
+}
+
+Arena *
+_allocarena(usize blksz)
+{
+	Arena *a;
+
+	a = _emalloc(sizeof *a);
+	memset(a, 0, sizeof *a);
+	a->blksz = blksz;
+	return a;
+}
+
+void *
+_arenaalloc(Arena *a, usize size)
+{
+	Arenablk *b;
+	void *p;
+
+	size = (size + ARENAALIGN-1) & ~(ARENAALIGN-1);
+	b = a->blk;
+	if(b == nil || b->cap - b->len < size){
+		b = allocarenablk(max(size, a->blksz));
+		b->next = a->blk;
+		a->blk = b;
+	}
+	p = (uchar*)b->data + b->len;
+	b->len += size;
+	return p;
+}
+
+void
+_freearena(Arena *a)
+{
+	Arenablk *b, *nb;
+
+	if(a == nil)
+		return;
+
+	for(b = a->blk; b != nil; b = nb){
+		nb = b->next;
+		free(b);
+	}
+	free(a);
+}
@@ -0,0 +1,491 @@
+#include <u.h>
+#include <libc.h>
+#include <thread.h>
+#include <draw.h>
+#include <memdraw.h>
+#include <geometry.h>
+#include "graphics.h"
+#include "internal.h"
+
+/*
+ * bounding volume hierarchy over the world-space boxes of a
+ * scene's entities.
+ *
+ * it's built top-down, splitting the entities in half along the
+ * longest axis of their centers, and rebuilt from scratch only when
+ * some are added or removed.  every leaf remembers the frame and the
+ * model bounds its box was fit to, and before a query the ones that
+ * changed get refit and propagated up to the root.  the scene can
+ * also be told an entity moved, to have it done right away.
+ *
+ * references:
+ * 	- “Ray Tracing Deformable Scenes Using Dynamic Bounding Volume Hierarchies”, Wald et al., ACM TOG vol. 26, 2007
+ * 	- “Physically Based Rendering: From Theory to Implementation”, Pharr, Jakob, Humphreys, 4th ed., § 7.3
+ */
+
+static Point3
+centroid(Bvhnode *n)
+{
+	return lerp3(n->min, n->max, 0.5);
+}
+
+static int
+cmpx(void *a, void *b)
+{
+	double d;
+
+	d = centroid(a).x - centroid(b).x;
+	return d < 0? -1: d > 0;
+}
+
+static int
+cmpy(void *a, void *b)
+{
+	double d;
+
+	d = centroid(a).y - centroid(b).y;
+	return d < 0? -1: d > 0;
+}
+
+static int
+cmpz(void *a, void *b)
+{
+	double d;
+
+	d = centroid(a).z - centroid(b).z;
+	return d < 0? -1: d > 0;
+}
+
+static void
+boxunion(Bvhnode *n, Bvhnode *a, Bvhnode *b)
+{
+	n->min.x = min(a->min.x, b->min.x);
+	n->min.y = min(a->min.y, b->min.y);
+	n->min.z = min(a->min.z, b->min.z);
+	n->max.x = max(a->max.x, b->max.x);
+	n->max.y = max(a->max.y, b->max.y);
+	n->max.z = max(a->max.z, b->max.z);
+	n->min.w = n->max.w = 1;
+}
+
+/* fits the leaf's box around its entity's, in world space */
+static void
+leafbounds(Bvhnode *n)
+{
+	Entity *e;
+	Bounds *b;
+	Point3 p;
+	int i;
+
+	e = n->ent;
+	n->frame = *(RFrame3*)e;
+	b = e->mdl->getbounds(e->mdl);
+	if(b == nil){
+		n->min = n->max = n->mmin = n->mmax = e->p;
+		return;
+	}
+	n->mmin = b->min;
+	n->mmax = b->max;
+
+	for(i = 0; i < 8; i++){
+		p.x = i & 1? b->max.x: b->min.x;
+		p.y = i & 2? b->max.y: b->min.y;
+		p.z = i & 4? b->max.z: b->min.z;
+		p.w = 1;
+		p = model2world(e, p);
+		if(i == 0){
+			n->min = n->max = p;
+			continue;
+		}
+		n->min.x = min(n->min.x, p.x);
+		n->min.y = min(n->min.y, p.y);
+		n->min.z = min(n->min.z, p.z);
+		n->max.x = max(n->max.x, p.x);
+		n->max.y = max(n->max.y, p.y);
+		n->max.z = max(n->max.z, p.z);
+	}
+}
+
+/* lays out the subtree for leaves[0:nl] at nodes[i] */
+static void
+build(Bvh *bvh, int i, int parent, Bvhnode *leaves, int nl)
+{
+	static int (*cmp[])(void*, void*) = { cmpx, cmpy, cmpz };
+	Bvhnode *n;
+	Point3 lo, hi, c, Δ;
+	int j, axis;
+
+	n = &bvh->nodes[i];
+	if(nl == 1){
+		*n = leaves[0];
+		n->parent = parent;
+		n->child = -1;
+		n->ent->bvhleaf = i;
+		return;
+	}
+
+	lo = hi = centroid(&leaves[0]);
+	for(j = 1; j < nl; j++){
+		c = centroid(&leaves[j]);
+		lo.x = min(lo.x, c.x);
+		lo.y = min(lo.y, c.y);
+		lo.z = min(lo.z, c.z);
+		hi.x = max(hi.x, c.x);
+		hi.y = max(hi.y, c.y);
+		hi.z = max(hi.z, c.z);
+	}
+	Δ = subpt3(hi, lo);
+	axis = Δ.x >= Δ.y && Δ.x >= Δ.z? 0: Δ.y >= Δ.z? 1: 2;
+	qsort(leaves, nl, sizeof(Bvhnode), cmp[axis]);
+
+	memset(n, 0, sizeof *n);
+	n->parent = parent;
+	n->child = bvh->nnodes;
+	bvh->nnodes += 2;
+	build(bvh, n->child, i, leaves, nl/2);
+	build(bvh, n->child+1, i, leaves + nl/2, nl - nl/2);
+	boxunion(n, &bvh->nodes[n->child], &bvh->nodes[n->child+1]);
+}
+
+static void
+rebuild(Bvh *bvh, Scene *s)
+{
+	Bvhnode *leaves;
+	Entity *e;
+	int i;
+
+	free(bvh->nodes);
+	bvh->nodes = nil;
+	bvh->nnodes = 0;
+	bvh->stale = 0;
+	if(s->nents < 1)
+		return;
+
+	leaves = _emalloc(s->nents*sizeof(Bvhnode));
+	for(i = 0, e = s->ents.next; e != &s->ents; i++, e = e->next){
+		memset(&leaves[i], 0, sizeof(Bvhnode));
+		leaves[i].ent = e;
+		leafbounds(&leaves[i]);
+	}
+
+	bvh->nodes = _emalloc((2*s->nents - 1)*sizeof(Bvhnode));
+	bvh->nnodes = 1;
+	build(bvh, 0, -1, leaves, s->nents);
+	free(leaves);
+}
+
+/* whether the leaf's entity or model changed since it was fit */
+static int
+moved(Bvhnode *n)
+{
+	Entity *e;
+	Bounds *b;
+
+	e = n->ent;
+	if(!eqpt3(e->p, n->frame.p) || !eqpt3(e->bx, n->frame.bx)
+	|| !eqpt3(e->by, n->frame.by) || !eqpt3(e->bz, n->frame.bz))
+		return 1;
+	b = e->mdl->getbounds(e->mdl);
+	if(b == nil)
+		return !eqpt3(n->mmin, e->p);
+	return !eqpt3(b->min, n->mmin) || !eqpt3(b->max, n->mmax);
+}
+
+/* refits the leaf and its ancestors, in O(log n) */
+static void
+refit(Bvh *bvh, Bvhnode *n)
+{
+	leafbounds(n);
+	while(n->parent >= 0){
+		n = &bvh->nodes[n->parent];
+		boxunion(n, &bvh->nodes[n->child], &bvh->nodes[n->child+1]);
+	}
+}
+
+/* gets the tree in sync with the scene.  it must be locked */
+static Bvh *
+getbvh(Scene *s)
+{
+	Bvh *bvh;
+	Bvhnode *n;
+
+	bvh = &s->bvh;
+	if(bvh->stale){
+		rebuild(bvh, s);
+		return bvh;
+	}
+	for(n = bvh->nodes; n < bvh->nodes + bvh->nnodes; n++)
+		if(n->child < 0 && moved(n))
+			refit(bvh, n);
+	return bvh;
+}
+
+/*
+ * -1 if the box is out of the frustum, 1 if it's entirely within,
+ * and 0 if it crosses any of its planes.
+ */
+static int
+classifybox(Camera *c, Point3 lo, Point3 hi)
+{
+	Point3 p;
+	int i, oc, oand, oor;
+
+	oand = ~0;
+	oor = 0;
+	for(i = 0; i < 8; i++){
+		p.x = i & 1? hi.x: lo.x;
+		p.y = i & 2? hi.y: lo.y;
+		p.z = i & 4? hi.z: lo.z;
+		p.w = 1;
+		p = world2clip(c, p);
+		oc = 0;
+		if(p.x < -p.w) oc |= 1<<0;
+		if(p.x >  p.w) oc |= 1<<1;
+		if(p.y < -p.w) oc |= 1<<2;
+		if(p.y >  p.w) oc |= 1<<3;
+		if(p.z < -p.w) oc |= 1<<4;
+		if(p.z >  p.w) oc |= 1<<5;
+		oand &= oc;
+		oor |= oc;
+	}
+	return oand != 0? -1: oor == 0;
+}
+
+/* leaves the visible ones in vis, negated if they're entirely inside */
+static void
+cull(Bvh *bvh, int i, Camera *c, int inside, int *vis, int *nvis)
+{
+	Bvhnode *n;
+
+	n = &bvh->nodes[i];
+	if(!inside)
+		switch(classifybox(c, n->min, n->max)){
+		case -1: return;
+		case 1: inside = 1;
+		}
+
+	if(n->child < 0){
+		vis[(*nvis)++] = inside? -i-1: i+1;
+		return;
+	}
+	cull(bvh, n->child, c, inside, vis, nvis);
+	cull(bvh, n->child+1, c, inside, vis, nvis);
+}
+
+/*
+ * calls f for every entity whose box reaches into c's frustum,
+ * telling it whether the box was entirely inside.  the tree is
+ * only locked while they're collected, so f can take its time.
+ */
+void
+_bvhcull(Scene *s, Camera *c, void (*f)(Entity*, int, void*), void *a)
+{
+	Bvh *bvh;
+	Entity **ents;
+	int *vis, nvis, i;
+
+	qlock(&s->bvh);
+	bvh = getbvh(s);
+	if(bvh->nnodes < 1){
+		qunlock(&s->bvh);
+		return;
+	}
+	vis = _emalloc(bvh->nnodes*sizeof(int));
+	nvis = 0;
+	cull(bvh, 0, c, 0, vis, &nvis);
+	ents = _emalloc((nvis+1)*sizeof(Entity*));
+	for(i = 0; i < nvis; i++)
+		ents[i] = bvh->nodes[abs(vis[i])-1].ent;
+	qunlock(&s->bvh);
+
+	for(i = 0; i < nvis; i++)
+		f(ents[i], vis[i] < 0, a);
+	free(ents);
+	free(vis);
+}
+
+/* slab test of the ray o + t·d, t ≥ 0, against [lo,hi] along one axis */
+static int
+slab(double o, double d, double lo, double hi, double *t0, double *t1)
+{
+	double ta, tb, t;
+
+	if(d == 0)
+		return o >= lo && o <= hi;
+
+	ta = (lo - o)/d;
+	tb = (hi - o)/d;
+	if(ta > tb){
+		t = ta;
+		ta = tb;
+		tb = t;
+	}
+	*t0 = max(*t0, ta);
+	*t1 = min(*t1, tb);
+	return *t0 <= *t1;
+}
+
+static int
+rayxbox(Point3 o, Point3 d, Bvhnode *n, double *t)
+{
+	double t0, t1;
+
+	t0 = 0;
+	t1 = *t;
+	if(!slab(o.x, d.x, n->min.x, n->max.x, &t0, &t1)
+	|| !slab(o.y, d.y, n->min.y, n->max.y, &t0, &t1)
+	|| !slab(o.z, d.z, n->min.z, n->max.z, &t0, &t1))
+		return 0;
+	*t = t0;
+	return 1;
+}
+
+static void
+raycast(Bvh *bvh, int i, Point3 o, Point3 d, Entity **e, double *tmin)
+{
+	Bvhnode *n, *c0, *c1;
+	double t, t0, t1;
+	int first;
+
+	n = &bvh->nodes[i];
+	t = *tmin;
+	if(!rayxbox(o, d, n, &t))
+		return;
+
+	if(n->child < 0){
+		*e = n->ent;
+		*tmin = t;
+		return;
+	}
+
+	/* visit the nearest child first, to prune the other one */
+	c0 = &bvh->nodes[n->child];
+	c1 = c0+1;
+	t0 = t1 = *tmin;
+	if(!rayxbox(o, d, c0, &t0))
+		t0 = Inf(1);
+	if(!rayxbox(o, d, c1, &t1))
+		t1 = Inf(1);
+	first = t1 < t0;
+	raycast(bvh, n->child + first, o, d, e, tmin);
+	raycast(bvh, n->child + !first, o, d, e, tmin);
+}
+
+/*
+ * returns the first entity whose box is hit by the ray from o along
+ * d, and in *t its distance in units of d.
+ */
+Entity *
+_bvhraycast(Scene *s, Point3 o, Point3 d, double *t)
+{
+	Bvh *bvh;
+	Entity *e;
+	double tmin;
+
+	e = nil;
+	tmin = Inf(1);
+	qlock(&s->bvh);
+	bvh = getbvh(s);
+	if(bvh->nnodes > 0)
+		raycast(bvh, 0, o, d, &e, &tmin);
+	qunlock(&s->bvh);
+	if(e != nil && t != nil)
+		*t = tmin;
+	return e;
+}
+
+static double
+boxdist(Point3 p, Bvhnode *n)
+{
+	Point3 Δ;
+
+	Δ.x = max(max(n->min.x - p.x, 0), p.x - n->max.x);
+	Δ.y = max(max(n->min.y - p.y, 0), p.y - n->max.y);
+	Δ.z = max(max(n->min.z - p.z, 0), p.z - n->max.z);
+	Δ.w = 0;
+	return vec3len(Δ);
+}
+
+static void
+nearest(Bvh *bvh, int i, Point3 p, Entity **e, double *dmin)
+{
+	Bvhnode *n;
+	double d0, d1;
+	int first;
+
+	n = &bvh->nodes[i];
+	if(n->child < 0){
+		d0 = boxdist(p, n);
+		if(d0 < *dmin){
+			*e = n->ent;
+			*dmin = d0;
+		}
+		return;
+	}
+
+	d0 = boxdist(p, &bvh->nodes[n->child]);
+	d1 = boxdist(p, &bvh->nodes[n->child+1]);
+	first = d1 < d0;
+	if(min(d0, d1) < *dmin)
+		nearest(bvh, n->child + first, p, e, dmin);
+	if(max(d0, d1) < *dmin)
+		nearest(bvh, n->child + !first, p, e, dmin);
+}
+
+/*
+ * returns the entity whose box is the closest to p, and in *d its
+ * distance—zero if p is inside it.
+ */
+Entity *
+_bvhnearest(Scene *s, Point3 p, double *d)
+{
+	Bvh *bvh;
+	Entity *e;
+	double dmin;
+
+	e = nil;
+	dmin = Inf(1);
+	qlock(&s->bvh);
+	bvh = getbvh(s);
+	if(bvh->nnodes > 0)
+		nearest(bvh, 0, p, &e, &dmin);
+	qunlock(&s->bvh);
+	if(e != nil && d != nil)
+		*d = dmin;
+	return e;
+}
+
+void
+_bvhinvalidate(Scene *s)
+{
+	qlock(&s->bvh);
+	s->bvh.stale = 1;
+	qunlock(&s->bvh);
+}
+
+/* refits e's leaf and its ancestors right away */
+void
+_bvhrefit(Scene *s, Entity *e)
+{
+	Bvh *bvh;
+
+	bvh = &s->bvh;
+	qlock(bvh);
+	/* a stale tree will be rebuilt with the new boxes anyway */
+	if(bvh->stale || e->bvhleaf < 0 || e->bvhleaf >= bvh->nnodes
+	|| bvh->nodes[e->bvhleaf].ent != e){
+		qunlock(bvh);
+		return;
+	}
+
+	refit(bvh, &bvh->nodes[e->bvhleaf]);
+	qunlock(bvh);
+}
+
+void
+_freebvh(Bvh *bvh)
+{
+	free(bvh->nodes);
+	bvh->nodes = nil;
+	bvh->nnodes = 0;
+}
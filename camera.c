@@ -7,106 +7,6 @@
 #include "graphics.h"
 #include "internal.h"
 
-/*
- * references:
- * 	- https://learnopengl.com/Advanced-OpenGL/Cubemaps
- */
-static Point3
-skyboxvs(Shaderparams *sp)
-{
-	Point3 p;
-
-	sp->setattr(sp, "dir", VAPoint, &sp->v->p);
-	/* only rotate along with the camera */
-	p = sp->v->p;
-	p.w = 0; p = world2vcs(sp->camera, p);
-	p.w = 1; p = vcs2clip(sp->camera, p);
-	/* force the cube to always be on the far plane */
-	p.z = -p.w;
-	return p;
-}
-
-static Color
-skyboxfs(Shaderparams *sp)
-{
-	Vertexattr *va;
-
-	va = sp->getattr(sp, "dir");
-	return samplecubemap(sp->scene->skybox, va->p, neartexsampler);
-}
-
-static Shadertab skyboxshader = {
-	.name		= "*skybox*",
-	.vs		= skyboxvs,
-	.fs		= skyboxfs
-};
-
-static Material skyboxmtl = {
-	.name		= "*skybox*",
-	.shaders	= &skyboxshader
-};
-
-static Model *
-mkskyboxmodel(void)
-{
-	static int indices[] = {
-		/* front */
-		0, 1, 4+1,	0, 4+1, 4+0,
-		/* right */
-		1, 2, 4+2,	1, 4+2, 4+1,
-		/* bottom */
-		0, 3, 2,	0, 2, 1,
-		/* back */
-		3, 4+3, 4+2,	3, 4+2, 2,
-		/* left */
-		0, 4+0, 4+3,	0, 4+3, 3,
-		/* top */
-		4+0, 4+1, 4+2,	4+0, 4+2, 4+3,
-	};
-	Model *m;
-	Primitive t;
-	Vertex v;
-	Point3 p;
-	int i, k;
-//	int f, j;
-
-	m = newmodel();
-	t = mkprim(PTriangle);
-	v = mkvert();
-
-	t.mtl = m->addmaterial(m, skyboxmtl);
-
-	/* build bottom and top quads around y-axis */
-	p = Pt3(-0.5,-0.5,0.5,1);
-	for(i = 0; i < 8; i++){
-		if(i == 4)
-			p.y++;
-		v.p = m->addposition(m, p);
-		m->addvert(m, v);
-		p = qrotate(p, Vec3(0,1,0), PI/2);
-	}
-
-	for(i = 0; i < nelem(indices); i++){
-//		f = i/6 % 6;
-//		j = i/3 % 2;
-		k = i % 3;
-		t.v[k] = indices[i];
-		if(k == 3-1){
-			m->addprim(m, t);
-
-//			Point3 p0, p1;
-//			for(k = 0; k < 3; k++){
-//				p0 = *(Point3*)bunchget(m->positions, t.v[k]);
-//				p1 = *(Point3*)bunchget(m->positions, t.v[(k+1)%3]);
-//				if(eqpt3(p0, p1))
-//					fprint(2, "face %d disfigured (tri #%d, verts %d %V and %d %V)\n", f, j, k, p0, k+1, p1);
-//			}
-		}
-	}
-
-	return m;
-}
-
 static void
 updatestats(Camera *c, uvlong v)
 {
@@ -163,7 +63,7 @@ newcamera(void)
 
 	c = _emalloc(sizeof *c);
 	memset(c, 0, sizeof *c);
-	c->rendopts = RODepth;
+	c->rendopts = RODepth|ROGuard;
 	return c;
 }
 
@@ -265,9 +165,6 @@ printtimings(Renderjob *job)
 void
 shootcamera(Camera *c)
 {
-	static Scene *skyboxscene;
-	static Shadertab skyboxshader = { nil, skyboxvs, skyboxfs };
-	Model *mdl;
 	Framebufctl *fbctl;
 	Renderjob *job;
 	uvlong t0, t1;
@@ -288,24 +185,6 @@ shootcamera(Camera *c)
 	t0 = nanosec();
 	sendp(c->rctl->jobq, job);
 	recvp(job->donec);
-	/*
-	 * if the scene has a skybox, do another render pass,
-	 * filling in the pixels left untouched.
-	 */
-	if(c->scene->skybox != nil){
-		if(skyboxscene == nil){
-			skyboxscene = newscene("skybox");
-			mdl = mkskyboxmodel();
-			skyboxscene->addent(skyboxscene, newentity("skybox", mdl));
-		}
-		job->camera->cullmode = CullNone;
-		job->camera->fov = 90*DEG;
-		reloadcamera(job->camera);
-		job->camera->scene = skyboxscene;
-		job->camera->scene->skybox = c->scene->skybox;
-		sendp(c->rctl->jobq, job);
-		recvp(job->donec);
-	}
 	t1 = nanosec();
 	fbctl->swap(fbctl);
 	fbctl->reset(fbctl);
@@ -7,13 +7,6 @@
 #include "graphics.h"
 #include "internal.h"
 
-enum {
-	CLIPL = 1,
-	CLIPR = 2,
-	CLIPT = 4,
-	CLIPB = 8,
-};
-
 static void
 mulsdm(double r[6], double m[6][4], Point3 p)
 {
@@ -131,111 +124,158 @@ allin:
 	return np;
 }
 
-/* TODO bring these back when we get inline */
-//static int
-//ptisinside(int code)
-//{
-//	return !code;
-//}
-//
-//static int
-//lineisinside(int code0, int code1)
-//{
-//	return !(code0|code1);
-//}
-//
-//static int
-//lineisoutside(int code0, int code1)
-//{
-//	return code0 & code1;
-//}
-
-#define ptisinside(c)		(!c)
-#define lineisinside(c0, c1)	(!(c0|c1))
-#define lineisoutside(c0, c1)	(c0&c1)
+/*
+ * a triangle can gain at most one vertex per plane.
+ */
+enum {
+	MAXCLIPVERTS = 3+6,
+};
 
-static int
-outcode(Point p, Rectangle r)
+typedef struct Clipvert Clipvert;
+struct Clipvert
 {
-	int code;
-
-	code = 0;
-	if(p.x < r.min.x) code |= CLIPL;
-	if(p.x > r.max.x) code |= CLIPR;
-	if(p.y < r.min.y) code |= CLIPT;
-	if(p.y > r.max.y) code |= CLIPB;
-	return code;
-}
+	Point3	p;
+	Point3	bc;	/* barycentric coords within the input triangle */
+	int	src;	/* input vertex it came from, or -1 if it's new */
+	int	edge;	/* input edge the one to the next vertex lies on, or -1 */
+};
 
-/* lerp vertex attributes to match the new positions */
-void
-_adjustlineverts(Point *p0, Point *p1, BVertex *v0, BVertex *v1)
+/*
+ * same as _clipprimitive, for triangles only.  rather than lerping
+ * every attribute at every plane crossing, it only carries the
+ * positions around along with their barycentric coords, and builds
+ * the output vertices at the end, once each.
+ */
+int
+_cliptriangle(BPrimitive *p, BPrimitive *cp)
 {
-	BVertex v[2];
-	Point3 dp;
-	Point v0p, Δp;
-	double len, perc;
+	static double sdm[6][4] = {
+		 1,  0,  0, 1,	/* l */
+		-1,  0,  0, 1,	/* r */
+		 0,  1,  0, 1,	/* b */
+		 0, -1,  0, 1,	/* t */
+		 0,  0,  1, 1,	/* f */
+		 0,  0, -1, 1,	/* n */
+	};
+	static Point3 unitbc[3] = {
+		{1, 0, 0, 0},
+		{0, 1, 0, 0},
+		{0, 0, 1, 0},
+	};
+	Clipvert poly[2][MAXCLIPVERTS], *Vin, *Vout, *v0, *v1;
+	BVertex v[MAXCLIPVERTS];
+	double *pl, sd0, sd1, perc;
+	int i, j, nin, nout, np;
+
+	Vin = poly[0];
+	Vout = poly[1];
+	for(i = 0; i < 3; i++){
+		Vin[i].p = p->v[i].p;
+		Vin[i].bc = unitbc[i];
+		Vin[i].src = i;
+		Vin[i].edge = p->edge[i];
+	}
+	nin = 3;
+
+	for(j = 0; j < 6 && nin > 0; j++){
+		pl = sdm[j];
+		nout = 0;
+		for(i = 0; i < nin; i++){
+			v0 = &Vin[i];
+			v1 = &Vin[(i+1) % nin];
 
-	memset(v, 0, sizeof v);
+			sd0 = pl[0]*v0->p.x + pl[1]*v0->p.y + pl[2]*v0->p.z + pl[3]*v0->p.w;
+			sd1 = pl[0]*v1->p.x + pl[1]*v1->p.y + pl[2]*v1->p.z + pl[3]*v1->p.w;
 
-	dp = subpt3(v1->p, v0->p);
-	len = hypot(dp.x, dp.y);
-	v0p = (Point){v0->p.x, v0->p.y};
+			if(sd0 < 0 && sd1 < 0)
+				continue;
 
-	Δp = subpt(v0p, *p0);
-	perc = len == 0? 0: hypot(Δp.x, Δp.y)/len;
-	_lerpvertex(&v[0], v0, v1, perc);
+			if((sd0 < 0) != (sd1 < 0)){
+				perc = sd0/(sd0 - sd1);
+				Vout[nout].p = lerp3(v0->p, v1->p, perc);
+				Vout[nout].bc = lerp3(v0->bc, v1->bc, perc);
+				Vout[nout].src = -1;
+				/* going out, the next edge runs along the plane */
+				Vout[nout].edge = sd0 < 0? v0->edge: -1;
+				nout++;
+			}
 
-	Δp = subpt(v0p, *p1);
-	perc = len == 0? 0: hypot(Δp.x, Δp.y)/len;
-	_lerpvertex(&v[1], v0, v1, perc);
+			if(sd1 >= 0)
+				Vout[nout++] = *v1;
+		}
+		SWAP(Clipvert*, &Vin, &Vout);
+		nin = nout;
+	}
 
-	*v0 = v[0];
-	*v1 = v[1];
+	if(nin < 3)
+		return 0;
+
+	for(i = 0; i < nin; i++)
+		if(Vin[i].src >= 0)
+			v[i] = p->v[Vin[i].src];
+		else{
+			_berpvertex(&v[i], &p->v[0], &p->v[1], &p->v[2], Vin[i].bc);
+			v[i].p = Vin[i].p;
+		}
+
+	/* triangulate.  the fan's inner diagonals lie on no edge */
+	for(np = 0; np < nin-2; np++){
+		cp[np] = *p;
+		cp[np].v[0] = v[0];
+		cp[np].v[1] = v[np+1];
+		cp[np].v[2] = v[np+2];
+		cp[np].edge[0] = np == 0? Vin[0].edge: -1;
+		cp[np].edge[1] = Vin[np+1].edge;
+		cp[np].edge[2] = np == nin-3? Vin[nin-1].edge: -1;
+	}
+	return np;
+}
+
+static vlong
+ceildiv(vlong a, vlong b)	/* b > 0 */
+{
+	return a >= 0? (a + b-1)/b: -(-a/b);
 }
 
 /*
- * Cohen-Sutherland rectangle-line clipping
+ * clips a Bresenham line, drawn from p0 to p1 along x (so that
+ * p0.x ≤ p1.x and |Δy| ≤ Δx), against r.  instead of moving the
+ * end points, which would change the pixels picked in between, it
+ * returns the range of steps [*i0,*i1] that land within r, where
+ * step i is at (p0.x + i, p0.y ± ⌊(2i|Δy| + Δx)/2Δx⌋).
  */
 int
-_rectclipline(Rectangle r, Point *p0, Point *p1)
+_rectclipline(Rectangle r, Point p0, Point p1, int *i0, int *i1)
 {
-	int code0, code1;
-	int Δx, Δy;
-	double m;
+	vlong Δx, Δy, a, b, lo, hi;
 
-	Δx = p1->x - p0->x;
-	Δy = p1->y - p0->y;
-	m = Δx == 0? 0: (double)Δy/Δx;
+	Δx = p1.x - p0.x;
+	Δy = abs(p1.y - p0.y);
 
-	for(;;){
-		code0 = outcode(*p0, r);
-		code1 = outcode(*p1, r);
-
-		if(lineisinside(code0, code1))
-			return 1;
-		else if(lineisoutside(code0, code1))
-			return 0;
+	lo = max(r.min.x - p0.x, 0);
+	hi = min(r.max.x-1 - p0.x, Δx);
 
-		if(ptisinside(code0)){
-			SWAP(Point, p0, p1);
-			SWAP(int, &code0, &code1);
-		}
+	/* the y offsets within r */
+	if(p1.y >= p0.y){
+		a = r.min.y - p0.y;
+		b = r.max.y-1 - p0.y;
+	}else{
+		a = p0.y - (r.max.y-1);
+		b = p0.y - r.min.y;
+	}
 
-		if(code0 & CLIPL){
-			p0->y += (r.min.x - p0->x)*m;
-			p0->x = r.min.x;
-		}else if(code0 & CLIPR){
-			p0->y += (r.max.x - p0->x)*m;
-			p0->x = r.max.x;
-		}else if(code0 & CLIPT){
-			if(p0->x != p1->x && m != 0)
-				p0->x += (r.min.y - p0->y)/m;
-			p0->y = r.min.y;
-		}else if(code0 & CLIPB){
-			if(p0->x != p1->x && m != 0)
-				p0->x += (r.max.y - p0->y)/m;
-			p0->y = r.max.y;
-		}
+	if(Δy == 0){
+		if(a > 0 || b < 0)
+			return 0;
+	}else{
+		/* the offset is ≥ a from step ⌈(2a-1)Δx/2Δy⌉ on, and ≤ b before ⌈(2b+1)Δx/2Δy⌉ */
+		lo = max(lo, ceildiv((2*a-1)*Δx, 2*Δy));
+		hi = min(hi, ceildiv((2*b+1)*Δx, 2*Δy) - 1);
 	}
+
+	if(lo > hi)
+		return 0;
+	*i0 = lo;
+	*i1 = hi;
+	return 1;
 }
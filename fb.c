@@ -140,6 +140,33 @@ rasterconvF2C(Raster *dst, Raster *src)
 	}
 }
 
+/* convert a float color raster to a 32-bit one */
+static void
+rasterconvCF2C(Raster *dst, Raster *src)
+{
+	ulong *c, len;
+	float *f;
+
+	c = dst->data;
+	f = (float*)src->data;
+	len = Dx(dst->r)*Dy(dst->r);
+	for(; len--; f += 4)
+		*c++ = col2ul((Color){f[0], f[1], f[2], f[3]});
+}
+
+/* clears the tiles no rasterizer got to, before anyone looks */
+void
+_flushclears(Framebuf *fb)
+{
+	Point grid;
+	int t;
+
+	grid = _tilegrid(fb->r);
+	for(t = 0; t < grid.x*grid.y; t++)
+		if(fb->tiles[t] & TClear)
+			_cleartile(fb, t);
+}
+
 static void
 framebufctl_draw(Framebufctl *ctl, Image *dst, char *name, Viewport *view)
 {
@@ -149,6 +176,7 @@ framebufctl_draw(Framebufctl *ctl, Image *dst, char *name, Viewport *view)
 
 	qlock(ctl);
 	fb = ctl->getfb(ctl);
+	_flushclears(fb);
 
 	r = name == nil? fb->rasters: fb->fetchraster(fb, name);
 	if(r == nil){
@@ -161,6 +189,10 @@ framebufctl_draw(Framebufctl *ctl, Image *dst, char *name, Viewport *view)
 		r2 = _allocraster(nil, r->r, COLOR32);
 		rasterconvF2C(r2, r);
 		r = r2;
+	}else if(r->chan == COLOR128){
+		r2 = _allocraster(nil, r->r, COLOR32);
+		rasterconvCF2C(r2, r);
+		r = r2;
 	}
 
 	dr = fb->r;
@@ -186,6 +218,7 @@ framebufctl_memdraw(Framebufctl *ctl, Memimage *dst, char *name, Viewport *view)
 
 	qlock(ctl);
 	fb = ctl->getfb(ctl);
+	_flushclears(fb);
 
 	r = name == nil? fb->rasters: fb->fetchraster(fb, name);
 	if(r == nil){
@@ -198,6 +231,10 @@ framebufctl_memdraw(Framebufctl *ctl, Memimage *dst, char *name, Viewport *view)
 		r2 = _allocraster(nil, r->r, COLOR32);
 		rasterconvF2C(r2, r);
 		r = r2;
+	}else if(r->chan == COLOR128){
+		r2 = _allocraster(nil, r->r, COLOR32);
+		rasterconvCF2C(r2, r);
+		r = r2;
 	}
 
 	dr = fb->r;
@@ -224,32 +261,38 @@ framebufctl_swap(Framebufctl *ctl)
 	qunlock(ctl);
 }
 
+/*
+ * the pool is reused from frame to frame.  the per-pixel lists
+ * are emptied as they're squashed.
+ */
 static void
 resetAbuf(Abuf *buf)
 {
-	while(buf->nact--)
-		free(buf->act[buf->nact]->items);
-	free(buf->act);
-	free(buf->stk);
-	memset(buf, 0, sizeof *buf);
+	if(buf->runs != nil)
+		memset(buf->runs, 0, buf->nruns*sizeof(Fragrun));
+	buf->nclaimed = 0;
 }
 
+/*
+ * tiles are cleared lazily, by the rasterizer that claims them
+ * next, and only if something was drawn into them since the
+ * last time.
+ */
 static void
 framebufctl_reset(Framebufctl *ctl)
 {
 	Framebuf *fb;
-	Raster *r;
+	Point grid;
+	int t;
 
 	/* address the back buffer—resetting the front buffer is VERBOTEN */
 	fb = ctl->getbb(ctl);
 	resetAbuf(&fb->abuf);
 
-	r = fb->rasters;		/* color buffer */
-	_clearraster(r, 0);
-	r = r->next;			/* z-buffer */
-	_fclearraster(r, Inf(-1));
-	while((r = r->next) != nil)
-		_clearraster(r, 0);	/* every other raster */
+	grid = _tilegrid(fb->r);
+	for(t = 0; t < grid.x*grid.y; t++)
+		if(fb->tiles[t] & TDirty)
+			fb->tiles[t] |= TClear;
 }
 
 static Framebuf *
@@ -275,13 +318,30 @@ framebufctl_createraster(Framebufctl *ctl, char *name, ulong chan)
 	return 0;
 }
 
+/*
+ * the caller may write anywhere in the raster, out of our sight,
+ * so every tile is taken as drawn into and gets cleared by the
+ * next reset.
+ */
 static Raster *
 framebufctl_fetchraster(Framebufctl *ctl, char *name)
 {
 	Framebuf *fb;
+	Raster *r;
+	Point grid;
+	int t;
 
+	qlock(ctl);
 	fb = ctl->getfb(ctl);
-	return fb->fetchraster(fb, name);
+	_flushclears(fb);
+	r = fb->fetchraster(fb, name);
+	if(r != nil){
+		grid = _tilegrid(fb->r);
+		for(t = 0; t < grid.x*grid.y; t++)
+			fb->tiles[t] |= TDirty;
+	}
+	qunlock(ctl);
+	return r;
 }
 
 static int
@@ -303,6 +363,7 @@ fb_createraster(Framebuf *fb, char *name, ulong chan)
 		r = &(*r)->next;
 	}
 	*r = _allocraster(name, fb->r, chan);
+	_clearraster(*r, 0);
 	return 0;
 }
 
@@ -320,10 +381,46 @@ fb_fetchraster(Framebuf *fb, char *name)
 	return nil;
 }
 
+Point
+_tilegrid(Rectangle r)
+{
+	return Pt((Dx(r) + TILESZ-1)/TILESZ, (Dy(r) + TILESZ-1)/TILESZ);
+}
+
+Rectangle
+_tilerect(Rectangle fbr, Point grid, int t)
+{
+	Rectangle r;
+
+	r.min.x = fbr.min.x + t%grid.x*TILESZ;
+	r.min.y = fbr.min.y + t/grid.x*TILESZ;
+	r.max.x = min(r.min.x + TILESZ, fbr.max.x);
+	r.max.y = min(r.min.y + TILESZ, fbr.max.y);
+	return r;
+}
+
+void
+_cleartile(Framebuf *fb, int t)
+{
+	Raster *r;
+	Rectangle tr;
+
+	tr = _tilerect(fb->r, _tilegrid(fb->r), t);
+
+	r = fb->rasters;		/* color buffer */
+	_clearrasterrect(r, tr, 0);
+	r = r->next;			/* z-buffer */
+	_fclearrasterrect(r, tr, Inf(-1));
+	while((r = r->next) != nil)
+		_clearrasterrect(r, tr, 0);	/* every other raster */
+	fb->tiles[t] = 0;
+}
+
 Framebuf *
 _mkfb(Rectangle r)
 {
 	Framebuf *fb;
+	Point grid;
 
 	fb = _emalloc(sizeof *fb);
 	memset(fb, 0, sizeof *fb);
@@ -333,6 +430,11 @@ _mkfb(Rectangle r)
 
 	fb->createraster(fb, "color", COLOR32);
 	fb->createraster(fb, "depth", FLOAT32);
+	_fclearraster(fb->rasters->next, Inf(-1));
+
+	grid = _tilegrid(r);
+	fb->tiles = _emalloc(grid.x*grid.y);
+	memset(fb->tiles, 0, grid.x*grid.y);
 
 	return fb;
 }
@@ -346,6 +448,11 @@ _rmfb(Framebuf *fb)
 		nr = r->next;
 		_freeraster(r);
 	}
+	free(fb->abuf.frags);
+	free(fb->abuf.heads);
+	free(fb->abuf.runs);
+	free(fb->kbuf);
+	free(fb->tiles);
 	free(fb);
 }
 
@@ -30,11 +30,22 @@ enum {
 	/* raster formats */
 	COLOR32 = 0,		/* RGBA32 */
 	FLOAT32,		/* F32 */
+	COLOR128,		/* RGBA F32 */
 
 	/* texture formats */
 	RAWTexture = 0,		/* unmanaged */
 	sRGBTexture,
 
+	/* texture storage */
+	TSRGBA16 = 0,		/* 16 bits per channel */
+	TSBC1,			/* 4×4 blocks, 4 bits per texel */
+	TSBC3,			/* 4×4 blocks, 8 bits per texel */
+
+	/* texture wrap modes */
+	TWClamp = 0,
+	TWRepeat,
+	TWMirror,
+
 	/* viewport sampling filters */
 	VFNearest = 0,
 	VFBilinear,
@@ -43,6 +54,12 @@ enum {
 	ROBlend	= 0x01,
 	RODepth	= 0x02,
 	ROAbuff	= 0x04,
+	ROFixpt	= 0x08,
+	ROCull	= 0x10,
+	ROWireframe	= 0x20,
+	ROKbuff	= 0x40,
+	ROWblend	= 0x80,
+	ROGuard	= 0x100,
 
 	/* vertex attribute types */
 	VAPoint = 0,
@@ -56,6 +73,7 @@ enum {
 
 typedef struct Bunch		Bunch;
 typedef struct Color		Color;
+typedef struct Texmip		Texmip;
 typedef struct Texture		Texture;
 typedef struct Cubemap		Cubemap;
 typedef struct Vertexattr	Vertexattr;
@@ -65,17 +83,25 @@ typedef struct BVertex		BVertex;
 typedef struct LightSource	LightSource;
 typedef struct Material		Material;
 typedef struct Primitive	Primitive;
+typedef struct Bounds		Bounds;
 typedef struct Model		Model;
 typedef struct Entity		Entity;
 typedef struct Scene		Scene;
+typedef struct Bvh		Bvh;
+typedef struct Bvhnode		Bvhnode;
 typedef struct Shaderparams	Shaderparams;
 typedef struct Shadertab	Shadertab;
 typedef struct Rendertime	Rendertime;
 typedef struct Renderer		Renderer;
 typedef struct Renderjob	Renderjob;
+typedef struct Arena		Arena;
+typedef struct Edgecache	Edgecache;
+typedef struct Tilebin		Tilebin;
+typedef struct Tileq		Tileq;
 typedef struct Fragment		Fragment;
-typedef struct Astk		Astk;
+typedef struct Fragrun		Fragrun;
 typedef struct Abuf		Abuf;
+typedef struct Kfrag		Kfrag;
 typedef struct Raster		Raster;
 typedef struct Framebuf		Framebuf;
 typedef struct Framebufctl	Framebufctl;
@@ -96,12 +122,24 @@ struct Color
 	double	r, g, b, a;
 };
 
+struct Texmip
+{
+	int		w, h;
+	int		tw;		/* tiles per row */
+	ushort		*texels;	/* linear RGBA, 16 bits per channel, not pre-multiplied */
+	uchar		*blocks;	/* or compressed, one per tile */
+};
+
 struct Texture
 {
 	Ref;
 	int		type;
 	char		*file;
 	Memimage	*image;
+	int		storage;
+	int		wrap;		/* texture wrap mode */
+	Texmip		*mip;		/* mip[0] is the full-size image */
+	int		nmip;
 };
 
 struct Cubemap
@@ -207,6 +245,13 @@ struct Primitive
 	ulong		mtl;		/* material idx */
 };
 
+struct Bounds
+{
+	Point3		min, max;	/* axis-aligned box */
+	Point3		c;		/* bounding sphere center */
+	double		r;		/* and radius */
+};
+
 struct Model
 {
 	Ref;
@@ -219,6 +264,9 @@ struct Model
 	Bunch		*verts;
 	Bunch		*prims;
 	Bunch		*materials;
+	Bounds		bounds;		/* of the positions, see getbounds */
+	int		boundsok;	/* clear it if you change them by hand */
+	Edgecache	*edges;		/* for wireframes (see model.c) */
 
 	ulong		(*addposition)(Model*, Point3);
 	ulong		(*addnormal)(Model*, Point3);
@@ -229,6 +277,7 @@ struct Model
 	ulong		(*addprim)(Model*, Primitive);
 	ulong		(*addmaterial)(Model*, Material);
 	ulong		(*findmaterial)(Model*, char*);
+	Bounds*		(*getbounds)(Model*);
 };
 
 struct Entity
@@ -238,6 +287,16 @@ struct Entity
 	Model		*mdl;
 	Entity		*prev;
 	Entity		*next;
+	int		bvhleaf;	/* in the scene's bvh, -1 if not yet */
+};
+
+/* entity bounding volume hierarchy (see bvh.c) */
+struct Bvh
+{
+	QLock;
+	Bvhnode		*nodes;
+	ulong		nnodes;
+	int		stale;		/* entities were added or removed */
 };
 
 struct Scene
@@ -247,11 +306,15 @@ struct Scene
 	ulong		nents;
 	Bunch		*lights;
 	Cubemap		*skybox;
+	Bvh		bvh;
 
 	void		(*addent)(Scene*, Entity*);
 	void		(*delent)(Scene*, Entity*);
 	Entity*		(*getent)(Scene*, char*);
 	ulong		(*addlight)(Scene*, LightSource*);
+	Entity*		(*castray)(Scene*, Point3, Point3, double*);
+	Entity*		(*nearestent)(Scene*, Point3, double*);
+	void		(*moveent)(Scene*, Entity*);
 };
 
 struct Shaderparams
@@ -262,7 +325,10 @@ struct Shaderparams
 	Scene		*scene;
 	BVertex		*v;
 	Point		p;	/* fragment position (fshader-only) */
-	uint		idx;	/* vertex index (vshader-only) */
+	Point2		duvdx;	/* uv derivatives along x and y (fshader-only) */
+	Point2		duvdy;
+	uint		idx;	/* vertex index within the primitive (vshader-only, informative) */
+	ulong		vidx;	/* and within the model (vshader-only) */
 
 	Vertexattr*	(*getuniform)(Shaderparams*, char*);
 	Vertexattr*	(*getattr)(Shaderparams*, char*);
@@ -297,6 +363,9 @@ struct Renderjob
 	Framebuf	*fb;
 	Camera		*camera;
 	Channel		*donec;
+	Arena		**arenas;	/* primitives (one arena per tiler) */
+	Tilebin		**bins;		/* Tilebin[ntiles] per tiler */
+	Tileq		*tileqs;	/* tiles left to raster (one queue per rasterizer) */
 	Renderjob	*next;
 	struct {
 		Rendertime	R;	/* renderer */
@@ -310,21 +379,37 @@ struct Fragment
 {
 	Color	c;
 	float	z;
+	ulong	next;	/* in the pixel's list */
 };
 
-struct Astk
+/* a stretch of the pool owned by a single tile */
+struct Fragrun
 {
-	Point		p;
-	Fragment	*items;
-	ulong		size;
+	ulong	next;
+	ulong	end;
 };
 
+/*
+ * fragments live in a pool shared by the whole framebuffer,
+ * and are referred to by their index plus one, so that 0 can
+ * end a list.  tiles take them from the pool in runs.
+ */
 struct Abuf
 {
-	QLock;
-	Astk		*stk;	/* framebuffer fragment stacks */
-	Astk		**act;	/* active fragment stacks */
-	ulong		nact;
+	Fragment	*frags;		/* fragment pool */
+	ulong		*heads;		/* per-pixel fragment lists */
+	Fragrun		*runs;		/* one per tile */
+	int		nruns;
+	long		nclaimed;	/* runs handed out */
+	ulong		cap;		/* available */
+	int		full;		/* ran out since the last frame */
+};
+
+/* k-buffer fragment */
+struct Kfrag
+{
+	ushort	c[4];	/* linear RGBA, straight alpha */
+	float	z;	/* -∞ if unused */
 };
 
 struct Raster
@@ -341,6 +426,10 @@ struct Framebuf
 	Rectangle	r;
 	Raster		*rasters;	/* [0] color, [1] depth, [2..n] user-defined */
 	Abuf		abuf;		/* A-buffer */
+	Kfrag		*kbuf;		/* k-buffer, nearest fragments first */
+	Raster		*wbaccum;	/* weighted blending sums (COLOR128) */
+	Raster		*wbcover;	/* and coverage (FLOAT32) */
+	uchar		*tiles;		/* per-tile clear state */
 
 	int		(*createraster)(Framebuf*, char*, ulong);
 	Raster*		(*fetchraster)(Framebuf*, char*);
@@ -394,6 +483,7 @@ struct Camera
 	double		zfar;
 	int		cullmode;
 	int		rendopts;
+	usize		abufcap;	/* A-buffer memory cap in bytes (0 for the default) */
 	int		projtype;
 	Matrix3		proj;		/* VCS to clip space xform */
 	Matrix3		invproj;	/* clip space to VCS xform */
@@ -474,10 +564,13 @@ void		compactmodel(Model*);
 Texture*	alloctexture(int, Memimage*);
 Texture*	reftexture(Texture*);
 Texture*	duptexture(Texture*);
+void		compresstexture(Texture*);
 void		freetexture(Texture*);
 Color		neartexsampler(Texture*, Point2);
 Color		bilitexsampler(Texture*, Point2);
+Color		tritexsampler(Texture*, Point2, Point2, Point2);
 Color		sampletexture(Texture*, Point2, Color(*)(Texture*, Point2));
+Color		fsampletexture(Shaderparams*, Texture*, Point2);
 Cubemap*	alloccubemap(char*, Texture*[6]);
 Cubemap*	readcubemap(char*[6]);
 Cubemap*	dupcubemap(Cubemap*, Cubemap**);
@@ -1,8 +1,19 @@
 enum {
 	ε1 = 1e-5,
 	ε2 = 1e-6,
+
+	TILESZ	= 64,		/* rasterization bin size */
+
+	/* framebuffer tile state */
+	TDirty	= 1<<0,		/* drawn into since the last clear */
+	TClear	= 1<<1,		/* to be cleared before it's used again */
+
+	/* weighted blending passes, on top of the render options */
+	ROOpaque	= 1<<16,	/* opaque fragments only */
+	ROTransl	= 1<<17,	/* translucent ones, behind the opaque depth */
 };
 
+typedef struct Arenablk		Arenablk;
 typedef struct BPrimitive	BPrimitive;
 typedef struct Polygon		Polygon;
 typedef struct Commontask	Commontask;
@@ -10,11 +21,74 @@ typedef struct Entityparam	Entityparam;
 typedef struct Entitytask	Entitytask;
 typedef struct Tilerparam	Tilerparam;
 typedef struct Tilertask	Tilertask;
+typedef struct Vcentry		Vcentry;
+typedef struct Primq		Primq;
 typedef struct Rasterparam	Rasterparam;
 typedef struct Rastertask	Rastertask;
 typedef struct pGradient	pGradient;
 typedef struct vGradient	vGradient;
 typedef struct Gradients	Gradients;
+typedef struct Edgefn		Edgefn;
+typedef struct Trisetup		Trisetup;
+typedef struct Ringwait		Ringwait;
+typedef struct Ring		Ring;
+typedef struct Binblk		Binblk;
+
+struct Arenablk
+{
+	Arenablk	*next;
+	usize		len;
+	usize		cap;
+	uvlong		data[];
+};
+
+/* a model's distinct edges */
+struct Edgecache
+{
+	ulong		*ids;		/* three per primitive */
+	ulong		n;
+	ulong		nprims;		/* it was built for */
+	ulong		nverts;
+};
+
+struct Arena
+{
+	Arenablk	*blk;		/* current block */
+	usize		blksz;
+};
+
+struct Ringwait
+{
+	int		sleeping;
+	long		sem;
+};
+
+/* single-producer, single-consumer; sides kept on separate cache lines */
+struct Ring
+{
+	uchar		*items;
+	ulong		mask;
+	ulong		elemsz;
+	Ringwait	*cw;		/* consumer's */
+
+	uchar		_pad0[64];
+	ulong		tail;		/* published */
+	ulong		ptail;		/* written */
+	Ringwait	pw;		/* producer's */
+
+	uchar		_pad1[64];
+	ulong		head;
+};
+
+struct Bvhnode
+{
+	Point3		min, max;	/* world space box */
+	int		parent;
+	int		child;		/* the first of two, -1 for leaves */
+	Entity		*ent;		/* leaves only */
+	RFrame3		frame;		/* the box was fit to, leaves only */
+	Point3		mmin, mmax;
+};
 
 struct BPrimitive
 {
@@ -22,11 +96,12 @@ struct BPrimitive
 	BVertex		v[3];
 	Point3		tangent;	/* used for normal mapping */
 	Material	*mtl;
+	int		edge[3];	/* model edge v[i]→v[i+1] lies on, -1 if clipping made it */
 };
 
 struct Polygon
 {
-	BVertex		v[8];
+	BVertex		v[3+6];	/* a triangle gains at most one per clipping plane */
 	ulong		n;
 };
 
@@ -52,30 +127,79 @@ struct Entitytask
 struct Tilerparam
 {
 	int		id;
-	Channel		*taskc;
-	Channel		**taskchans;	/* Channel*[nproc] */
+	Ring		*taskq;
+	Ringwait	w;
+	Channel		**rjobcs;	/* Channel*[nproc], one per rasterizer */
 	Rectangle	*wr;		/* Rectangle[nproc] */
+	Vcentry		*vcache;	/* Vcentry[VCACHESZ] */
 	ulong		nproc;
 };
 
+/* post-transform vertex cache entry */
+struct Vcentry
+{
+	uvlong		jobid;
+	Entity		*ent;
+	ulong		vi;		/* Model.verts index */
+	ulong		tangent;	/* Model.tangents index */
+	Material	*mtl;
+	BVertex		v;		/* as it came out of the vertex shader */
+};
+
+/* a batch of a job's primitives, handed out to the tilers in chunks */
+struct Primq
+{
+	Ref;				/* tilers yet to finish it */
+	Entity		**ents;
+	ulong		*first;		/* prefix sums of the ents' prim counts */
+	ulong		nents;
+	ulong		nprims;
+	int		**edgebits;	/* per entity, the model edges drawn (wireframe only) */
+	long		nchunks;
+	long		next;		/* claimed with ainc */
+};
+
 struct Tilertask
 {
 	Commontask;
-	Primitive	*eb, *ee;
+	Primq		*q;
 };
 
 struct Rasterparam
 {
 	int		id;
-	Channel		*taskc;
+	Channel		*jobc;		/* jobs done tiling */
+	ulong		nproc;
 };
 
 struct Rastertask
 {
 	Commontask;
 	Shaderparams	*fsp;
+	uint		ropts;		/* the camera's, plus the pass's */
 	Rectangle	wr;		/* working rect */
-	BPrimitive	p;
+	BPrimitive	*p;		/* points and lines */
+	Trisetup	*setup;		/* triangles */
+};
+
+struct Binblk
+{
+	Binblk		*next;
+	int		n;
+	Rastertask	t[16];
+};
+
+struct Tilebin
+{
+	Binblk		*first, *last;
+};
+
+/* tiles id, id+nproc, id+2·nproc…, claimed with ainc */
+struct Tileq
+{
+	long		next;
+	long		n;
+	uchar		_pad[64];
 };
 
 struct pGradient
@@ -98,6 +222,21 @@ struct Gradients
 	pGradient	bc;
 };
 
+/* E(x,y) = ax + by + c, over fixed-point coordinates */
+struct Edgefn
+{
+	vlong	a, b, c;
+};
+
+/* shared by every rasterizer the triangle is sent to */
+struct Trisetup
+{
+	Material	*mtl;
+	Rectangle	bbox;
+	Edgefn		e[3];		/* positive inside */
+	Gradients	∇;		/* origin at the bbox's first pixel */
+};
+
 /* alloc */
 void*		_emalloc(ulong);
 void*		_erealloc(void*, ulong);
@@ -105,10 +244,37 @@ char*		_estrdup(char*);
 char*		_equotestrdup(char*);
 Memimage*	_eallocmemimage(Rectangle, ulong);
 
+/* arena */
+Arena*	_allocarena(usize);
+void*	_arenaalloc(Arena*, usize);
+void	_freearena(Arena*);
+
+/* ring */
+Ring*	_allocring(ulong, ulong, Ringwait*);
+void	_freering(Ring*);
+void	_ringput(Ring*, void*);
+void	_ringflush(Ring*);
+ulong	_ringget(Ring*, void**);
+void	_ringrelease(Ring*, ulong);
+void	_ringwait(Ringwait*, Ring**, int);
+
+/* bvh */
+void	_bvhcull(Scene*, Camera*, void(*)(Entity*, int, void*), void*);
+Entity*	_bvhraycast(Scene*, Point3, Point3, double*);
+Entity*	_bvhnearest(Scene*, Point3, double*);
+void	_bvhinvalidate(Scene*);
+void	_bvhrefit(Scene*, Entity*);
+void	_freebvh(Bvh*);
+
+/* model */
+Edgecache*	_modeledges(Model*);
+
 /* raster */
 Raster*	_allocraster(char*, Rectangle, ulong);
 void	_clearraster(Raster*, ulong);
 void	_fclearraster(Raster*, float);
+void	_clearrasterrect(Raster*, Rectangle, ulong);
+void	_fclearrasterrect(Raster*, Rectangle, float);
 uchar*	_rasterbyteaddr(Raster*, Point);
 void	_rasterput(Raster*, Point, void*);
 void	_rasterget(Raster*, Point, void*);
@@ -121,6 +287,10 @@ void	_freeraster(Raster*);
 /* fb */
 Framebuf*	_mkfb(Rectangle);
 void		_rmfb(Framebuf*);
+Point		_tilegrid(Rectangle);
+Rectangle	_tilerect(Rectangle, Point, int);
+void		_cleartile(Framebuf*, int);
+void		_flushclears(Framebuf*);
 Framebufctl*	_mkfbctl(Rectangle);
 void		_rmfbctl(Framebufctl*);
 
@@ -128,6 +298,7 @@ void		_rmfbctl(Framebufctl*);
 void		_lerpvertex(BVertex*, BVertex*, BVertex*, double);
 void		_berpvertex(BVertex*, BVertex*, BVertex*, BVertex*, Point3);
 void		_addvertex(BVertex*, BVertex*);
+void		_maddvertex(BVertex*, BVertex*, double);
 void		_mulvertex(BVertex*, double);
 void		_fprintvattrs(int, Vertexattrs*);
 void		_addvattr(Vertexattrs*, char*, int, void*);
@@ -135,8 +306,8 @@ Vertexattr*	_getvattr(Vertexattrs*, char*);
 
 /* clip */
 int	_clipprimitive(BPrimitive*, BPrimitive*);
-void	_adjustlineverts(Point*, Point*, BVertex*, BVertex*);
-int	_rectclipline(Rectangle, Point*, Point*);
+int	_cliptriangle(BPrimitive*, BPrimitive*);
+int	_rectclipline(Rectangle, Point, Point, int*, int*);
 
 /* util */
 void	_memsetl(void*, ulong, usize);
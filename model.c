@@ -57,6 +57,7 @@ delmaterial(Material *mtl)
 static ulong
 model_addposition(Model *m, Point3 p)
 {
+	m->boundsok = 0;
 	return bunchadd(m->positions, &p);
 }
 
@@ -84,15 +85,27 @@ model_addtangent(Model *m, Point3 T)
 	return bunchadd(m->tangents, &T);
 }
 
+static void
+dropedges(Model *m)
+{
+	if(m->edges != nil){
+		free(m->edges->ids);
+		free(m->edges);
+		m->edges = nil;
+	}
+}
+
 static ulong
 model_addvert(Model *m, Vertex v)
 {
+	dropedges(m);
 	return bunchadd(m->verts, &v);
 }
 
 static ulong
 model_addprim(Model *m, Primitive P)
 {
+	dropedges(m);
 	return bunchadd(m->prims, &P);
 }
 
@@ -121,6 +134,116 @@ model_findmaterial(Model *m, char *name)
 	return NaI;
 }
 
+/*
+ * the sphere is centered on the box, which is not the tightest
+ * fit, but it's good enough for culling.
+ */
+static Bounds *
+model_getbounds(Model *m)
+{
+	Bounds *b;
+	Point3 *p, *pe;
+	double r;
+
+	b = &m->bounds;
+	if(m->boundsok)
+		return b;
+
+	if(m->positions->nitems < 1)
+		return nil;
+
+	p = m->positions->items;
+	pe = p + m->positions->nitems;
+	b->min = b->max = *p;
+	for(p++; p < pe; p++){
+		b->min.x = min(b->min.x, p->x);
+		b->min.y = min(b->min.y, p->y);
+		b->min.z = min(b->min.z, p->z);
+		b->max.x = max(b->max.x, p->x);
+		b->max.y = max(b->max.y, p->y);
+		b->max.z = max(b->max.z, p->z);
+	}
+	b->min.w = b->max.w = 1;
+
+	b->c = lerp3(b->min, b->max, 0.5);
+	b->r = 0;
+	for(p = m->positions->items; p < pe; p++){
+		r = vec3len(subpt3(*p, b->c));
+		b->r = max(b->r, r);
+	}
+
+	m->boundsok = 1;
+	return b;
+}
+
+/*
+ * numbers the distinct edges of the model's triangles, so that
+ * one shared by two of them can be told apart.  edges are told
+ * apart by their end positions, regardless of direction, and the
+ * ids are stored three per primitive, NaI for non-triangles or
+ * malformed ones.  the result is kept until vertices or primitives
+ * are added.
+ */
+Edgecache *
+_modeledges(Model *m)
+{
+	Edgecache *ec;
+	Primitive *P;
+	Vertex *v;
+	ulong *tab, *e, a, b, t, h, size, i, k, nprims, nverts;
+
+	nprims = m->prims->nitems;
+	nverts = m->verts->nitems;
+	if(m->edges != nil && m->edges->nprims == nprims && m->edges->nverts == nverts)
+		return m->edges;
+
+	dropedges(m);
+	ec = m->edges = _emalloc(sizeof *ec);
+	ec->ids = _emalloc((3*nprims + 1)*sizeof(ulong));
+	ec->n = 0;
+	ec->nprims = nprims;
+	ec->nverts = nverts;
+
+	for(size = 1; size < 2*3*nprims; size <<= 1)
+		;
+	tab = _emalloc(size*3*sizeof(ulong));	/* a, b, id */
+	memset(tab, 0xff, size*3*sizeof(ulong));
+
+	P = m->prims->items;
+	v = m->verts->items;
+	for(i = 0; i < nprims; i++, P++)
+	for(k = 0; k < 3; k++){
+		e = &ec->ids[3*i + k];
+		*e = NaI;
+		if(P->type != PTriangle
+		|| P->v[k] >= nverts || P->v[(k+1)%3] >= nverts)
+			continue;
+
+		a = v[P->v[k]].p;
+		b = v[P->v[(k+1)%3]].p;
+		if(a == NaI || b == NaI)
+			continue;
+		if(a > b){
+			t = a;
+			a = b;
+			b = t;
+		}
+
+		for(h = (a*31 + b)*2654435761UL & size-1;; h = h+1 & size-1){
+			if(tab[3*h+2] == NaI){
+				tab[3*h+0] = a;
+				tab[3*h+1] = b;
+				tab[3*h+2] = ec->n++;
+			}
+			if(tab[3*h+0] == a && tab[3*h+1] == b)
+				break;
+		}
+		*e = tab[3*h+2];
+	}
+	free(tab);
+	return ec;
+}
+
 Model *
 newmodel(void)
 {
@@ -145,6 +268,7 @@ newmodel(void)
 	m->addprim	= model_addprim;
 	m->addmaterial	= model_addmaterial;
 	m->findmaterial	= model_findmaterial;
+	m->getbounds	= model_getbounds;
 	incref(m);
 	return m;
 }
@@ -189,6 +313,7 @@ delmodel(Model *m)
 		freebunch(m->verts);
 		freebunch(m->prims);
 		freebunch(m->materials);	/* TODO this leaks material properties (name and textures). fix it */
+		dropedges(m);
 		free(m->name);
 		free(m);
 	}
@@ -7,17 +7,23 @@
 #include "graphics.h"
 #include "internal.h"
 
+static int
+pixelsize(ulong chan)
+{
+	return chan == COLOR128? 4*4: 4;
+}
+
 Raster *
 _allocraster(char *name, Rectangle rr, ulong chan)
 {
 	Raster *r;
 
-	if(chan > FLOAT32){
+	if(chan > COLOR128){
 		werrstr("bad format");
 		return nil;
 	}
 
-	r = _emalloc(sizeof(Raster) + 4*Dx(rr)*Dy(rr));
+	r = _emalloc(sizeof(Raster) + pixelsize(chan)*Dx(rr)*Dy(rr));
 	memset(r, 0, sizeof(Raster));
 	if(name != nil)
 		snprint(r->name, sizeof r->name, "%s", name);
@@ -29,19 +35,35 @@ _allocraster(char *name, Rectangle rr, ulong chan)
 void
 _clearraster(Raster *r, ulong v)
 {
-	_memsetl(r->data, v, Dx(r->r)*Dy(r->r));
+	_memsetl(r->data, v, Dx(r->r)*Dy(r->r)*pixelsize(r->chan)/4);
 }
 
 void
 _fclearraster(Raster *r, float v)
 {
-	_memsetl(r->data, *(ulong*)&v, Dx(r->r)*Dy(r->r));
+	_memsetl(r->data, *(ulong*)&v, Dx(r->r)*Dy(r->r)*pixelsize(r->chan)/4);
+}
+
+void
+_clearrasterrect(Raster *r, Rectangle rr, ulong v)
+{
+	int y, n;
+
+	n = Dx(rr)*pixelsize(r->chan)/4;
+	for(y = rr.min.y; y < rr.max.y; y++)
+		_memsetl(_rasterbyteaddr(r, Pt(rr.min.x, y)), v, n);
+}
+
+void
+_fclearrasterrect(Raster *r, Rectangle rr, float v)
+{
+	_clearrasterrect(r, rr, *(ulong*)&v);
 }
 
 uchar *
 _rasterbyteaddr(Raster *r, Point p)
 {
-	return (uchar*)&r->data[p.y*Dx(r->r) + p.x];
+	return (uchar*)r->data + (p.y*Dx(r->r) + p.x)*pixelsize(r->chan);
 }
 
 void
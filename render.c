@@ -10,6 +10,38 @@
 #define TILESTKSZ	(32*1024)
 #define PROCSTKSZ	(8*1024)
 
+enum {
+	FXBITS	= 8,		/* subpixel precision */
+	FXONE	= 1<<FXBITS,
+	FXHALF	= FXONE>>1,
+
+	BLKSZ	= 8,		/* rasterization block size (power of two) */
+
+	CHUNKSZ		= 256,		/* primitives per tiler work unit */
+	QBATCH		= 4,		/* chunks per tiler before a batch is released */
+	VCACHESZ	= 256,		/* post-transform vertex cache size (power of two) */
+	ARENABLKSZ	= 256*1024,	/* per-tiler primitive arena block */
+	ABUFCAP		= 256*1024*1024,	/* default A-buffer memory cap */
+	ABUFRUN		= 256,		/* fragments taken from the pool at once */
+	ABUFDEPTH	= 2,		/* initial A-buffer fragments per pixel */
+	KBUFSZ		= 4,		/* k-buffer fragments per pixel */
+
+	GUARDBAND	= 8,		/* in clip space, times the viewport's size */
+
+	/* outcodes */
+	OCLEFT		= 1<<0,
+	OCRIGHT		= 1<<1,
+	OCBOTTOM	= 1<<2,
+	OCTOP		= 1<<3,
+	OCFAR		= 1<<4,
+	OCNEAR		= 1<<5,
+	OCGLEFT		= 1<<6,		/* past the guard band */
+	OCGRIGHT	= 1<<7,
+	OCGBOTTOM	= 1<<8,
+	OCGTOP		= 1<<9,
+	OCGUARD		= OCGLEFT|OCGRIGHT|OCGBOTTOM|OCGTOP,
+};
+
 static Point3
 defvertexshader(Shaderparams *sp)
 {
@@ -21,7 +53,19 @@ defvertexshader(Shaderparams *sp)
 static Color
 defpicselshader(Shaderparams *sp)
 {
-	return sp->v->c;
+	Material *m;
+	Color c, tc;
+
+	c = sp->v->c;
+	m = sp->v->mtl;
+	if(m != nil && m->diffusemap != nil){
+		tc = fsampletexture(sp, m->diffusemap, sp->v->uv);
+		c.r *= tc.r;
+		c.g *= tc.g;
+		c.b *= tc.b;
+		c.a *= tc.a;
+	}
+	return c;
 }
 
 static Shadertab defstab = {
@@ -42,6 +86,13 @@ static Material defmtl = {
 	.shaders	= &defstab
 };
 
+/* materials without shaders of their own get the default ones */
+static Shadertab *
+getshaders(Material *m)
+{
+	return m->shaders != nil? m->shaders: &defstab;
+}
+
 static Vertexattr *
 sparams_getuniform(Shaderparams *sp, char *id)
 {
@@ -89,6 +140,7 @@ sparams_toraster(Shaderparams *sp, char *rname, void *v)
 	Framebuf *fb;
 	Raster *r;
 	ulong c;
+	float *f;
 
 	if(v == nil)
 		return;
@@ -106,6 +158,13 @@ sparams_toraster(Shaderparams *sp, char *rname, void *v)
 	case FLOAT32:
 		_rasterput(r, sp->p, v);
 		break;
+	case COLOR128:
+		f = (float*)_rasterbyteaddr(r, sp->p);
+		f[0] = ((Color*)v)->r;
+		f[1] = ((Color*)v)->g;
+		f[2] = ((Color*)v)->b;
+		f[3] = ((Color*)v)->a;
+		break;
 	}
 }
 
@@ -134,6 +193,86 @@ isvisible(Point3 p)
 	return 1;
 }
 
+/*
+ * tells whether any part of the entity's bounding volume lies
+ * within the frustum.  the sphere is tested in the VCS, against the
+ * planes of Camera.proj, which takes care of most of them;
+ * undecided ones get the corners of their box projected instead.
+ *
+ * references:
+ * 	- “Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix”, Gil Gribb, Klaus Hartmann, 2001
+ */
+static int
+isentvisible(Camera *c, Entity *e)
+{
+	Bounds *b;
+	Point3 p, pl;
+	double r, d;
+	int i, s, in, oc, occ;
+
+	b = e->mdl->getbounds(e->mdl);
+	if(b == nil)
+		return 0;
+
+	r = b->r * max(max(vec3len(e->bx), vec3len(e->by)), vec3len(e->bz));
+	p = world2vcs(c, model2world(e, b->c));
+	in = 1;
+	for(i = 0; i < 3; i++)
+	for(s = -1; s <= 1; s += 2){
+		pl.x = c->proj[3][0] + s*c->proj[i][0];
+		pl.y = c->proj[3][1] + s*c->proj[i][1];
+		pl.z = c->proj[3][2] + s*c->proj[i][2];
+		pl.w = c->proj[3][3] + s*c->proj[i][3];
+		d = (pl.x*p.x + pl.y*p.y + pl.z*p.z + pl.w)/vec3len(Vec3(pl.x, pl.y, pl.z));
+		if(d < -r)
+			return 0;
+		if(d < r)
+			in = 0;
+	}
+	if(in)
+		return 1;
+
+	occ = ~0;
+	for(i = 0; i < 8; i++){
+		p.x = i & 1? b->max.x: b->min.x;
+		p.y = i & 2? b->max.y: b->min.y;
+		p.z = i & 4? b->max.z: b->min.z;
+		p.w = 1;
+		p = world2clip(c, model2world(e, p));
+		oc = 0;
+		if(p.x < -p.w) oc |= 1<<0;
+		if(p.x >  p.w) oc |= 1<<1;
+		if(p.y < -p.w) oc |= 1<<2;
+		if(p.y >  p.w) oc |= 1<<3;
+		if(p.z < -p.w) oc |= 1<<4;
+		if(p.z >  p.w) oc |= 1<<5;
+		occ &= oc;
+	}
+	return occ == 0;
+}
+
+static int
+outcode(Point3 p)
+{
+	int oc;
+	double gw;
+
+	oc = 0;
+	if(p.x < -p.w) oc |= OCLEFT;
+	if(p.x >  p.w) oc |= OCRIGHT;
+	if(p.y < -p.w) oc |= OCBOTTOM;
+	if(p.y >  p.w) oc |= OCTOP;
+	if(p.z < -p.w) oc |= OCFAR;
+	if(p.z >  p.w) oc |= OCNEAR;
+
+	gw = GUARDBAND*p.w;
+	if(p.x < -gw) oc |= OCGLEFT;
+	if(p.x >  gw) oc |= OCGRIGHT;
+	if(p.y < -gw) oc |= OCGBOTTOM;
+	if(p.y >  gw) oc |= OCGTOP;
+	return oc;
+}
+
 static int
 isfacingback(BPrimitive *p)
 {
@@ -155,200 +294,420 @@ istoporleft(Point2 *e0, Point2 *e1)
 		|| (e01.y == 0 && e01.x < 0);	/* top */
 }
 
+/*
+ * the pool starts out at ABUFDEPTH fragments per pixel, and
+ * doubles, up to the cap, after every frame that ran out.
+ */
 static void
-initAbuf(Framebuf *fb)
+initAbuf(Framebuf *fb, usize memcap)
 {
-	if(fb->abuf.stk != nil)
-		return;
+	Abuf *buf;
+	usize npix, cap, maxcap;
 
-	fb->abuf.stk = _emalloc(Dx(fb->r)*Dy(fb->r)*sizeof(Astk));
-	memset(fb->abuf.stk, 0, Dx(fb->r)*Dy(fb->r)*sizeof(Astk));
+	buf = &fb->abuf;
+	npix = Dx(fb->r)*Dy(fb->r);
+	if(memcap == 0)
+		memcap = ABUFCAP;
+	maxcap = memcap > npix*sizeof(ulong)? (memcap - npix*sizeof(ulong))/sizeof(Fragment): 0;
+	if(buf->frags == nil)
+		cap = npix*ABUFDEPTH;
+	else if(buf->full)
+		cap = (usize)buf->cap*2;
+	else
+		cap = buf->cap;
+	cap = min(cap, maxcap);
+
+	if(buf->heads == nil){
+		buf->heads = _emalloc(npix*sizeof(ulong));
+		memset(buf->heads, 0, npix*sizeof(ulong));
+		buf->nruns = _tilegrid(fb->r).x*_tilegrid(fb->r).y;
+		buf->runs = _emalloc(buf->nruns*sizeof(Fragrun));
+	}
+	if(buf->cap != cap){
+		free(buf->frags);
+		buf->frags = cap > 0? _emalloc(cap*sizeof(Fragment)): nil;
+		buf->cap = cap;
+	}
+	memset(buf->runs, 0, buf->nruns*sizeof(Fragrun));
+	buf->nclaimed = 0;
+	buf->full = 0;
 }
 
-static void
-pushtoAbuf(Framebuf *fb, Point p, Color c, float z)
+/* f over b, for straight alpha */
+static Color
+overcolor(Color f, Color b)
 {
-	Abuf *buf;
-	Astk *stk;
-	int i;
+	Color c;
+	double ba;
+
+	ba = b.a*(1 - f.a);
+	c.a = f.a + ba;
+	if(c.a == 0)
+		return (Color){0, 0, 0, 0};
+	c.r = (f.r*f.a + b.r*ba)/c.a;
+	c.g = (f.g*f.a + b.g*ba)/c.a;
+	c.b = (f.b*f.a + b.b*ba)/c.a;
+	return c;
+}
 
-	buf = &fb->abuf;
-	stk = &buf->stk[p.y*Dx(fb->r) + p.x];
-	if(stk->size % 16 == 0){
-		stk->items = _erealloc(stk->items, (stk->size + 16)*sizeof(*stk->items));
-		memset(&stk->items[stk->size], 0, 16*sizeof(*stk->items));
+/*
+ * with the pool exhausted, room is made in the pixel's own
+ * list by blending its two farthest fragments together, or the
+ * new one into the farthest if it lies behind all of them.
+ * returns 0 if the list is empty.
+ */
+static int
+mergetoAbuf(Abuf *buf, ulong *head, Color c, float z)
+{
+	Fragment *f, *far, *far2;
+	ulong i;
+
+	far = far2 = nil;
+	for(i = *head; i != 0; i = f->next){
+		f = &buf->frags[i-1];
+		if(far == nil || f->z < far->z){
+			far2 = far;
+			far = f;
+		}else if(far2 == nil || f->z < far2->z)
+			far2 = f;
 	}
 
-	/* TODO don't push pixels that are behind opaque fragments */
-	for(i = 0; i < stk->size; i++)
-		if(z > stk->items[i].z)
-			break;
+	if(far == nil)
+		return 0;	/* nowhere to put it */
+	if(z <= far->z){
+		far->c = overcolor(far->c, c);
+		return 1;
+	}
+	if(far2 == nil){
+		far->c = overcolor(c, far->c);
+		far->z = z;
+		return 1;
+	}
+	far2->c = overcolor(far2->c, far->c);
+	far->c = c;
+	far->z = z;
+	return 1;
+}
+
+static int
+claimrun(Abuf *buf, Fragrun *run)
+{
+	ulong i;
+
+	if(buf->nclaimed*ABUFRUN >= buf->cap)
+		return 0;
+	i = ainc(&buf->nclaimed) - 1;
+	if(i*ABUFRUN >= buf->cap)
+		return 0;
+	run->next = i*ABUFRUN;
+	run->end = min(run->next + ABUFRUN, buf->cap);
+	return 1;
+}
 
-	if(i < stk->size)
-		memmove(&stk->items[i+1], &stk->items[i], (stk->size - i)*sizeof(*stk->items));
-	stk->items[i] = (Fragment){c, z};
+/*
+ * every pixel belongs to a single tile, and so to a single
+ * rasterizer at a time.  fragments come from the tile's own
+ * run, so the pool is only touched once every ABUFRUN of them.
+ * if it's exhausted and the pixel has no list to merge into,
+ * the fragment goes straight to the framebuffer, under
+ * whatever its list will later bring.
+ */
+static void
+pushtoAbuf(Framebuf *fb, Point p, Color c, float z, int blend)
+{
+	Abuf *buf;
+	Fragrun *run;
+	Fragment *f;
+	ulong *head, i;
 
-	if(stk->size++ < 1){
-		stk->p = p;
-		qlock(buf);
-		if(buf->nact % 64 == 0)
-			buf->act = _erealloc(buf->act, (buf->nact + 64)*sizeof(*buf->act));
-		buf->act[buf->nact++] = stk;
-		qunlock(buf);
+	/* TODO don't push pixels that are behind opaque fragments */
+	buf = &fb->abuf;
+	head = &buf->heads[p.y*Dx(fb->r) + p.x];
+	run = &buf->runs[p.y/TILESZ*_tilegrid(fb->r).x + p.x/TILESZ];
+	if(run->next == run->end && !claimrun(buf, run)){
+		buf->full = 1;
+		if(!mergetoAbuf(buf, head, c, z))
+			pixel(fb->rasters, p, c, blend);
+		return;
 	}
+	i = ++run->next;
+	f = &buf->frags[i-1];
+	f->c = c;
+	f->z = z;
+	f->next = *head;
+	*head = i;
 }
 
+/*
+ * sorts every pixel's fragments back-to-front and blends them
+ * together, in linear space, before putting the result into
+ * the framebuffer.  the lists are left empty.
+ */
 static void
 squashAbuf(Framebuf *fb, Rectangle *wr, int blend)
 {
 	Abuf *buf;
-	Astk *stk;
+	Fragment *f;
 	Raster *cr, *zr;
-	int x, y, ss;
+	Point p;
+	Color c;
+	ulong *head, *link, i, next, sorted;
 
 	buf = &fb->abuf;
 	cr = fb->rasters;
 	zr = cr->next;
-	for(y = wr->min.y; y < wr->max.y; y++)
-	for(x = wr->min.x; x < wr->max.x; x++){
-		stk = &buf->stk[y*Dx(*wr) + x];
-		ss = stk->size;
-		if(ss < 1)
+	for(p.y = wr->min.y; p.y < wr->max.y; p.y++)
+	for(p.x = wr->min.x; p.x < wr->max.x; p.x++){
+		head = &buf->heads[p.y*Dx(fb->r) + p.x];
+		if(*head == 0)
 			continue;
-		while(ss--)
-			pixel(cr, stk->p, stk->items[ss].c, blend);
+
+		sorted = 0;
+		for(i = *head; i != 0; i = next){
+			f = &buf->frags[i-1];
+			next = f->next;
+			for(link = &sorted; *link != 0 && buf->frags[*link-1].z <= f->z; link = &buf->frags[*link-1].next)
+				;
+			f->next = *link;
+			*link = i;
+		}
+		*head = 0;
+
+		c = (Color){0, 0, 0, 0};
+		for(i = sorted; i != 0; i = f->next){
+			f = &buf->frags[i-1];
+			c = blend? overcolor(f->c, c): f->c;
+		}
+		pixel(cr, p, c, blend);
 		/* write to the depth buffer as well */
-		putdepth(zr, stk->p, stk->items[0].z);
+		putdepth(zr, p, f->z);
 	}
 }
 
+/*
+ * the k-buffer is allocated along with the first frame that
+ * uses it, and never grows afterwards.
+ */
 static void
-rasterizept(Rastertask *task)
+initKbuf(Framebuf *fb)
 {
-	Shaderparams *sp;
-	Raster *cr, *zr;
-	BPrimitive *prim;
-	Point p;
-	Color c;
-	float z;
-	uint ropts;
+	Kfrag *f, *e;
+	usize n;
 
-	prim = &task->p;
-	sp = task->fsp;
+	if(fb->kbuf != nil)
+		return;
 
-	cr = sp->fb->rasters;
-	zr = cr->next;
+	n = (usize)Dx(fb->r)*Dy(fb->r)*KBUFSZ;
+	fb->kbuf = _emalloc(n*sizeof(Kfrag));
+	for(f = fb->kbuf, e = f + n; f < e; f++)
+		*f = (Kfrag){{0, 0, 0, 0}, Inf(-1)};
+}
 
-	ropts = sp->camera->rendopts;
+static Color
+getkfrag(Kfrag *k)
+{
+	return (Color){k->c[0]/65535.0, k->c[1]/65535.0, k->c[2]/65535.0, k->c[3]/65535.0};
+}
 
-	p = (Point){prim->v[0].p.x, prim->v[0].p.y};
+static void
+putkfrag(Kfrag *k, Color c, float z)
+{
+	k->c[0] = fclamp(c.r, 0, 1)*0xFFFF + 0.5;
+	k->c[1] = fclamp(c.g, 0, 1)*0xFFFF + 0.5;
+	k->c[2] = fclamp(c.b, 0, 1)*0xFFFF + 0.5;
+	k->c[3] = fclamp(c.a, 0, 1)*0xFFFF + 0.5;
+	k->z = z;
+}
 
-	z = fclamp(prim->v[0].p.z, 0, 1);
-	if((ropts & RODepth) && z <= getdepth(zr, p))
-		return;
+/*
+ * keeps the KBUFSZ nearest fragments of every pixel.  when a new
+ * one doesn't fit, the two farthest are blended into the last
+ * slot, which ends up holding the whole tail.
+ *
+ * references:
+ * 	- “Multi-Layer Alpha Blending”, Marco Salvi, Karthik Vaidyanathan, I3D '14, pp. 151-158
+ */
+static void
+pushtoKbuf(Framebuf *fb, Point p, Color c, float z)
+{
+	Kfrag *k, f, tail;
+	int i;
 
-	*sp->v = prim->v[0];
-	sp->p = p;
-	c = prim->mtl->shaders->fs(sp);
-	if(c.a == 0)			/* discard non-colors */
+	k = &fb->kbuf[(p.y*Dx(fb->r) + p.x)*KBUFSZ];
+	putkfrag(&f, c, z);
+
+	for(i = 0; i < KBUFSZ; i++)
+		if(z > k[i].z)
+			break;
+
+	if(i == KBUFSZ)
+		tail = f;
+	else if(isInf(k[KBUFSZ-1].z, -1)){
+		memmove(&k[i+1], &k[i], (KBUFSZ-1 - i)*sizeof(Kfrag));
+		k[i] = f;
 		return;
-	if(ropts & RODepth)
-		putdepth(zr, p, z);
-	if(ropts & ROAbuff)
-		pushtoAbuf(sp->fb, p, c, z);
-	else
-		pixel(cr, p, c, ropts & ROBlend);
+	}else{
+		tail = k[KBUFSZ-1];
+		memmove(&k[i+1], &k[i], (KBUFSZ-1 - i)*sizeof(Kfrag));
+		k[i] = f;
+	}
+	putkfrag(&k[KBUFSZ-1], overcolor(getkfrag(&k[KBUFSZ-1]), getkfrag(&tail)), k[KBUFSZ-1].z);
 }
 
+/* blends the fragments kept for every pixel back-to-front, and empties them */
 static void
-rasterizeline(Rastertask *task)
+squashKbuf(Framebuf *fb, Rectangle *wr, int blend)
 {
-	Shaderparams *sp;
+	Kfrag *k;
 	Raster *cr, *zr;
-	BPrimitive *prim;
-	Point p, dp, Δp, p0, p1;
-	Color c;
-	double dplen, perc;
-	float z, pcz;
-	uint ropts;
-	int steep, Δe, e, Δy;
-
-	prim = &task->p;
-	sp = task->fsp;
+	Point p;
+	Color c, kc;
+	int i;
 
-	cr = sp->fb->rasters;
+	cr = fb->rasters;
 	zr = cr->next;
+	for(p.y = wr->min.y; p.y < wr->max.y; p.y++)
+	for(p.x = wr->min.x; p.x < wr->max.x; p.x++){
+		k = &fb->kbuf[(p.y*Dx(fb->r) + p.x)*KBUFSZ];
+		if(isInf(k[0].z, -1))
+			continue;
 
-	ropts = sp->camera->rendopts;
+		c = (Color){0, 0, 0, 0};
+		for(i = KBUFSZ-1; i >= 0; i--){
+			if(isInf(k[i].z, -1))
+				continue;
+			kc = getkfrag(&k[i]);
+			c = blend? overcolor(kc, c): kc;
+			if(i > 0)
+				k[i].z = Inf(-1);
+		}
+		pixel(cr, p, c, blend);
+		/* write to the depth buffer as well */
+		putdepth(zr, p, k[0].z);
+		k[0].z = Inf(-1);
+	}
+}
 
-	p0 = (Point){prim->v[0].p.x, prim->v[0].p.y};
-	p1 = (Point){prim->v[1].p.x, prim->v[1].p.y};
-	/* clip it against our wr */
-	if(!_rectclipline(task->wr, &p0, &p1))
+/*
+ * the rasters for weighted blending are created along with the
+ * first frame that uses them, so they can be fetched and drawn
+ * like any other.  resetting the framebuffer clears them.
+ */
+static void
+initWblend(Framebuf *fb)
+{
+	if(fb->wbaccum != nil)
 		return;
 
-	_adjustlineverts(&p0, &p1, prim->v+0, prim->v+1);
+	if(fb->createraster(fb, "wbaccum", COLOR128) < 0
+	|| fb->createraster(fb, "wbcover", FLOAT32) < 0)
+		sysfatal("initWblend: %r");
+	fb->wbaccum = fb->fetchraster(fb, "wbaccum");
+	fb->wbcover = fb->fetchraster(fb, "wbcover");
+}
 
-	steep = 0;
-	/* transpose the points */
-	if(abs(p0.x-p1.x) < abs(p0.y-p1.y)){
-		steep = 1;
-		SWAP(int, &p0.x, &p0.y);
-		SWAP(int, &p1.x, &p1.y);
-	}
+/*
+ * adds the fragment to the weighted sums of its pixel.  nearer
+ * fragments weigh more, so they dominate the average without
+ * having to be sorted.  coverage is kept instead of revealage so
+ * that the rasters start out cleared to zero.
+ *
+ * references:
+ * 	- “Weighted Blended Order-Independent Transparency”, Morgan McGuire, Louis Bavoil, JCGT vol. 2, no. 2, 2013, pp. 122-141
+ */
+static void
+pushtoWblend(Framebuf *fb, Point p, Color c, float z)
+{
+	float *acc, *cov;
+	double w;
 
-	/* make them left-to-right */
-	if(p0.x > p1.x){
-		SWAP(Point, &p0, &p1);
-		SWAP(BVertex, prim->v+0, prim->v+1);
-	}
+	/* eq. (7), with z = 1 at the near plane */
+	w = c.a*fclamp(3e3*z*z*z, 1e-2, 3e3);
+
+	acc = (float*)_rasterbyteaddr(fb->wbaccum, p);
+	acc[0] += c.r*w;
+	acc[1] += c.g*w;
+	acc[2] += c.b*w;
+	acc[3] += w;
 
-	dp = subpt(p1, p0);
-	dplen = hypot(dp.x, dp.y);
-	dplen = dplen == 0? 0: 1.0/dplen;
-	Δe = 2*abs(dp.y);
-	e = 0;
-	Δy = p1.y > p0.y? 1: -1;
+	cov = (float*)_rasterbyteaddr(fb->wbcover, p);
+	*cov += c.a*(1 - *cov);
+}
 
-	for(p = p0; p.x <= p1.x; p.x++){
-		Δp = subpt(p, p0);
-		perc = dplen*hypot(Δp.x, Δp.y);
+/* composites the weighted average over the tile, and clears the sums */
+static void
+squashWblend(Framebuf *fb, Rectangle *wr, int blend)
+{
+	Raster *cr;
+	float *acc, *cov;
+	Point p;
+	Color c;
+	double w;
 
-		if(steep) SWAP(int, &p.x, &p.y);
+	cr = fb->rasters;
+	for(p.y = wr->min.y; p.y < wr->max.y; p.y++)
+	for(p.x = wr->min.x; p.x < wr->max.x; p.x++){
+		cov = (float*)_rasterbyteaddr(fb->wbcover, p);
+		if(*cov == 0)
+			continue;
 
-		z = flerp(prim->v[0].p.z, prim->v[1].p.z, perc);
-		/* TODO get rid of the bounds check and make sure the clipping doesn't overflow */
-		if(!ptinrect(p, sp->fb->r)
-		|| ((ropts & RODepth) && z <= getdepth(zr, p)))
-			goto discard;
+		acc = (float*)_rasterbyteaddr(fb->wbaccum, p);
+		w = acc[3] < 1e-5? 1e-5: acc[3];
+		c = (Color){acc[0]/w, acc[1]/w, acc[2]/w, *cov};
+		pixel(cr, p, c, blend);
+
+		memset(acc, 0, 4*sizeof(float));
+		*cov = 0;
+	}
+}
+
+static void
+rasterizept(Rastertask *task)
+{
+	Shaderparams *sp;
+	Raster *cr, *zr;
+	BPrimitive *prim;
+	Point p;
+	Color c;
+	float z;
+	uint ropts;
 
-		/* interpolate z⁻¹ and get actual z */
-		pcz = flerp(prim->v[0].p.w, prim->v[1].p.w, perc);
-		pcz = 1.0/(pcz < ε1? ε1: pcz);
+	prim = task->p;
+	sp = task->fsp;
 
-		/* perspective-correct attribute interpolation */
-		perc *= prim->v[0].p.w * pcz;
-		_lerpvertex(sp->v, prim->v+0, prim->v+1, perc);
+	cr = sp->fb->rasters;
+	zr = cr->next;
 
-		sp->p = p;
-		c = prim->mtl->shaders->fs(sp);
-		if(c.a == 0)			/* discard non-colors */
-			goto discard;
-		if(ropts & RODepth)
-			putdepth(zr, p, z);
-		if(ropts & ROAbuff)
-			pushtoAbuf(sp->fb, p, c, z);
-		else
-			pixel(cr, p, c, ropts & ROBlend);
-discard:
-		if(steep) SWAP(int, &p.x, &p.y);
+	ropts = task->ropts;
 
-		e += Δe;
-		if(e > dp.x){
-			p.y += Δy;
-			e -= 2*dp.x;
-		}
+	p = (Point){prim->v[0].p.x, prim->v[0].p.y};
+
+	z = fclamp(prim->v[0].p.z, 0, 1);
+	if((ropts & RODepth) && z <= getdepth(zr, p))
+		return;
+
+	*sp->v = prim->v[0];
+	sp->p = p;
+	sp->duvdx = sp->duvdy = (Point2){0, 0, 0};
+	c = getshaders(prim->mtl)->fs(sp);
+	if(c.a == 0)			/* discard non-colors */
+		return;
+	/* translucent fragments don't occlude */
+	if((ropts & ROOpaque) && c.a < 1 || (ropts & ROTransl) && c.a == 1)
+		return;
+	if(ropts & ROTransl){
+		pushtoWblend(sp->fb, p, c, z);
+		return;
 	}
+	/* nor do the ones kept for the A- or k-buffer */
+	if((ropts & RODepth) && (c.a == 1 || (ropts & (ROAbuff|ROKbuff)) == 0))
+		putdepth(zr, p, z);
+	if(ropts & ROAbuff)
+		pushtoAbuf(sp->fb, p, c, z, ropts & ROBlend);
+	else if(ropts & ROKbuff)
+		pushtoKbuf(sp->fb, p, c, z);
+	else
+		pixel(cr, p, c, ropts & ROBlend);
 }
 
 static Point3
@@ -385,64 +744,77 @@ initgradients(Gradients *∇, BPrimitive *prim, Point2 t[3], Point2 p0)
 	_berpvertex(&∇->v.dy, prim->v+0, prim->v+1, prim->v+2, ∇->bc.dy);
 }
 
-static Rectangle
-mktribbox(Point3 p0, Point3 p1, Point3 p2, Rectangle wr)
+static vlong
+fxpt(double v)
 {
-	Point l[6], *e0, *e1;
-	Rectangle r;
-
-	l[0] = (Point){p0.x+0.5, p0.y+0.5};
-	l[1] = (Point){p1.x+0.5, p1.y+0.5};
-	l[2] = l[1];
-	l[3] = (Point){p2.x+0.5, p2.y+0.5};
-	l[4] = l[3];
-	l[5] = l[0];
-
-	r.min = (Point){ 100000, 100000};
-	r.max = (Point){-100000,-100000};
-	for(e0 = &l[0], e1 = &l[1]; e1 < l + nelem(l); e0 += 2, e1 += 2)
-		if(_rectclipline(wr, e0, e1)){
-			r.min.x = min(r.min.x, e0->x); r.min.x = min(r.min.x, e1->x);
-			r.min.y = min(r.min.y, e0->y); r.min.y = min(r.min.y, e1->y);
-			r.max.x = max(r.max.x, e0->x); r.max.x = max(r.max.x, e1->x);
-			r.max.y = max(r.max.y, e0->y); r.max.y = max(r.max.y, e1->y);
-		}
-	/* exception when triangle surrounds the tile */
-	if(r.min.x > r.max.x || r.min.y > r.max.y)
-		return wr;
-	r.max.x++;
-	r.max.y++;
-	/* simplified rectclip(2) */
-	if(r.min.x < wr.min.x) r.min.x = wr.min.x;
-	if(r.min.y < wr.min.y) r.min.y = wr.min.y;
-	if(r.max.x > wr.max.x) r.max.x = wr.max.x;
-	if(r.max.y > wr.max.y) r.max.y = wr.max.y;
-	return r;
+	return floor(v*FXONE + 0.5);
 }
 
+/*
+ * the a→b edge function.  points to the right of the edge (as
+ * seen on screen, where y grows downwards) are positive.
+ */
 static void
-rasterizetri(Rastertask *task)
+mkedgefn(Edgefn *e, vlong ax, vlong ay, vlong bx, vlong by)
 {
-	Shaderparams *sp;
-	Raster *cr, *zr;
-	BPrimitive *prim;
-	Gradients ∇;
-	BVertex v;
-	Point p;
+	e->a = ay - by;
+	e->b = bx - ax;
+	e->c = ax*by - ay*bx;
+}
+
+static int
+istopleftfn(Edgefn *e)
+{
+	return e->a > 0			/* left */
+		|| (e->a == 0 && e->b > 0);	/* top */
+}
+
+/*
+ * triangle setup.  done once per primitive by the tiler, it
+ * gets the edge functions, the bounding box within fbr and the
+ * attribute gradients that every rasterizer will share.
+ */
+static int
+setuptri(Trisetup *s, BPrimitive *prim, Rectangle fbr)
+{
+	Edgefn *e;
 	Point2 t[3];
-	Point3 bc;
-	Color c;
-	uint ropts;
+	vlong x[3], y[3], area;
+	int i;
 
-	prim = &task->p;
-	sp = task->fsp;
+	e = s->e;
+	for(i = 0; i < 3; i++){
+		x[i] = fxpt(prim->v[i].p.x);
+		y[i] = fxpt(prim->v[i].p.y);
+	}
 
-	cr = sp->fb->rasters;
-	zr = cr->next;
+	mkedgefn(&e[0], x[1], y[1], x[2], y[2]);
+	mkedgefn(&e[1], x[2], y[2], x[0], y[0]);
+	mkedgefn(&e[2], x[0], y[0], x[1], y[1]);
 
-	ropts = sp->camera->rendopts;
+	area = e[2].a*x[2] + e[2].b*y[2] + e[2].c;
+	if(area == 0)
+		return -1;
 
-	task->wr = mktribbox(prim->v[0].p, prim->v[1].p, prim->v[2].p, task->wr);
+	/* make the inside positive regardless of the winding order */
+	if(area < 0)
+		for(i = 0; i < 3; i++){
+			e[i].a = -e[i].a;
+			e[i].b = -e[i].b;
+			e[i].c = -e[i].c;
+		}
+
+	/* fill rule: centers lying on an edge only belong to top and left ones */
+	for(i = 0; i < 3; i++)
+		if(!istopleftfn(&e[i]))
+			e[i].c--;
+
+	s->bbox.min.x = max((min(min(x[0], x[1]), x[2]) - FXHALF) >> FXBITS, fbr.min.x);
+	s->bbox.min.y = max((min(min(y[0], y[1]), y[2]) - FXHALF) >> FXBITS, fbr.min.y);
+	s->bbox.max.x = min(((max(max(x[0], x[1]), x[2]) - FXHALF) >> FXBITS) + 1, fbr.max.x);
+	s->bbox.max.y = min(((max(max(y[0], y[1]), y[2]) - FXHALF) >> FXBITS) + 1, fbr.max.y);
+	if(s->bbox.min.x >= s->bbox.max.x || s->bbox.min.y >= s->bbox.max.y)
+		return -1;
 
 	t[0] = (Point2){prim->v[0].p.x, prim->v[0].p.y, 1};
 	t[1] = (Point2){prim->v[1].p.x, prim->v[1].p.y, 1};
@@ -453,115 +825,611 @@ rasterizetri(Rastertask *task)
 	_mulvertex(prim->v+1, prim->v[1].p.w);
 	_mulvertex(prim->v+2, prim->v[2].p.w);
 
-	initgradients(&∇, prim, t, (Point2){task->wr.min.x+0.5, task->wr.min.y+0.5, 1});
-
-	/* TODO find a good method to apply the fill rule */
-//	if(istoporleft(&t[1], &t[2])) ∇.bc.p0.x -= ∇.bc.dx.x + ∇.bc.dy.x;
-//	if(istoporleft(&t[2], &t[0])) ∇.bc.p0.y -= ∇.bc.dx.y + ∇.bc.dy.y;
-//	if(istoporleft(&t[0], &t[1])) ∇.bc.p0.z -= ∇.bc.dx.z + ∇.bc.dy.z;
-
-	for(p.y = task->wr.min.y; p.y < task->wr.max.y; p.y++){
-		bc = ∇.bc.p0;
-		*sp->v = ∇.v.v0;
-	for(p.x = task->wr.min.x; p.x < task->wr.max.x; p.x++){
-//		if(p.x == task->wr.min.x || p.x == task->wr.max.x-1
-//		|| p.y == task->wr.min.y || p.y == task->wr.max.y-1){
-//			pixel(cr, p, (Color){1,0,0,1}, 0);
-//			putdepth(zr, p, 1);
-//		}
-		if(bc.x < 0 || bc.y < 0 || bc.z < 0)
-			goto discard;
+	initgradients(&s->∇, prim, t, (Point2){s->bbox.min.x+0.5, s->bbox.min.y+0.5, 1});
+	s->mtl = prim->mtl;
+	return 0;
+}
 
-		if((ropts & RODepth) && sp->v->p.z <= getdepth(zr, p))
-			goto discard;
+/*
+ * shades the fragment at sp->p, whose attributes (still
+ * multiplied by z⁻¹) are in sp->v, and change by ∇ per pixel.
+ * returns whether it got drawn.
+ */
+static int
+shadefrag(Shaderparams *sp, Material *mtl, uint ropts, vGradient *∇)
+{
+	Raster *cr, *zr;
+	BVertex v;
+	Color c;
+	double w;
 
-		/* perspective-correct attribute interpolation */
-		v = *sp->v;
-		_mulvertex(sp->v, 1.0/(sp->v->p.w < ε1? ε1: sp->v->p.w));
+	cr = sp->fb->rasters;
+	zr = cr->next;
 
-		sp->p = p;
-		c = prim->mtl->shaders->fs(sp);
-		*sp->v = v;
-		if(c.a == 0)			/* discard non-colors */
-			goto discard;
+	if((ropts & RODepth) && sp->v->p.z <= getdepth(zr, sp->p))
+		return 0;
+
+	/* the faces of a wireframe only fill the z-buffer */
+	if(ropts & ROWireframe){
 		if(ropts & RODepth)
-			putdepth(zr, p, sp->v->p.z);
-		if(ropts & ROAbuff)
-			pushtoAbuf(sp->fb, p, c, sp->v->p.z);
-		else
-			pixel(cr, p, c, ropts & ROBlend);
-discard:
-		bc = addpt3(bc, ∇.bc.dx);
-		_addvertex(sp->v, &∇.v.dx);
+			putdepth(zr, sp->p, sp->v->p.z);
+		return 0;
 	}
-		∇.bc.p0 = addpt3(∇.bc.p0, ∇.bc.dy);
-		_addvertex(&∇.v.v0, &∇.v.dy);
+
+	/* perspective-correct attribute interpolation */
+	v = *sp->v;
+	w = sp->v->p.w < ε1? ε1: sp->v->p.w;
+	_mulvertex(sp->v, 1.0/w);
+
+	/* uv derivatives, by the quotient rule */
+	sp->duvdx = (Point2){
+		(∇->dx.uv.x - sp->v->uv.x*∇->dx.p.w)/w,
+		(∇->dx.uv.y - sp->v->uv.y*∇->dx.p.w)/w,
+		0};
+	sp->duvdy = (Point2){
+		(∇->dy.uv.x - sp->v->uv.x*∇->dy.p.w)/w,
+		(∇->dy.uv.y - sp->v->uv.y*∇->dy.p.w)/w,
+		0};
+
+	c = getshaders(mtl)->fs(sp);
+	*sp->v = v;
+	if(c.a == 0)			/* discard non-colors */
+		return 0;
+	/* translucent fragments don't occlude */
+	if((ropts & ROOpaque) && c.a < 1 || (ropts & ROTransl) && c.a == 1)
+		return 0;
+	if(ropts & ROTransl){
+		pushtoWblend(sp->fb, sp->p, c, sp->v->p.z);
+		return 1;
 	}
+	/* nor do the ones kept for the A- or k-buffer */
+	if((ropts & RODepth) && (c.a == 1 || (ropts & (ROAbuff|ROKbuff)) == 0))
+		putdepth(zr, sp->p, sp->v->p.z);
+	if(ropts & ROAbuff)
+		pushtoAbuf(sp->fb, sp->p, c, sp->v->p.z, ropts & ROBlend);
+	else if(ropts & ROKbuff)
+		pushtoKbuf(sp->fb, sp->p, c, sp->v->p.z);
+	else
+		pixel(cr, sp->p, c, ropts & ROBlend);
+	return 1;
 }
 
+/*
+ * Bresenham's, along the major axis.  the attributes are stepped
+ * with a constant gradient, and the clipping against the tile is
+ * done in steps, so that every tile draws exactly the pixels the
+ * whole line would.
+ */
 static void
-rasterizer(void *arg)
+rasterizeline(Rastertask *task)
 {
-	static void(*rasterfn[])(Rastertask*) = {
-	 [PPoint]	rasterizept,
-	 [PLine]	rasterizeline,
-	 [PTriangle]	rasterizetri,
-	};
-	Rasterparam *rp;
-	Rastertask task;
-	Renderjob *job;
-	BVertex v;
-	Shaderparams fsp;
+	Shaderparams *sp;
+	Raster *zr;
+	BPrimitive *prim;
+	BVertex v[2];
+	vGradient ∇;
+	Rectangle r;
+	Point p0, p1, p;
+	double t;
+	float z;
+	uint ropts;
+	int steep, i, i0, i1, Δx, Δy, sy;
+	vlong e, k;
 
-	rp = arg;
-	threadsetname("rasterizer %d", rp->id);
+	prim = task->p;
+	sp = task->fsp;
 
-	memset(&fsp, 0, sizeof fsp);
-	fsp.v = &v;
-	fsp.getuniform = sparams_getuniform;
-	fsp.getattr = sparams_getattr;
-	fsp.toraster = sparams_toraster;
+	zr = sp->fb->rasters->next;
 
-	while(recv(rp->taskc, &task) > 0){
-		job = task.job;
-		if(job->rctl->doprof && job->times.Rn[rp->id].t0 == 0)
-			job->times.Rn[rp->id].t0 = nanosec();
+	ropts = task->ropts;
 
-		if(task.islast){
-			if(job->camera->rendopts & ROAbuff)
-				squashAbuf(job->fb, &task.wr, job->camera->rendopts & ROBlend);
+	/* the primitive is shared with other rasterizers */
+	v[0] = prim->v[0];
+	v[1] = prim->v[1];
+	p0 = (Point){v[0].p.x, v[0].p.y};
+	p1 = (Point){v[1].p.x, v[1].p.y};
+	r = task->wr;
 
-			if(decref(job) == 0){
-				if(job->rctl->doprof)
-					job->times.Rn[rp->id].t1 = nanosec();
+	/* transpose the points, and the tile along with them */
+	steep = abs(p0.x-p1.x) < abs(p0.y-p1.y);
+	if(steep){
+		SWAP(int, &p0.x, &p0.y);
+		SWAP(int, &p1.x, &p1.y);
+		SWAP(int, &r.min.x, &r.min.y);
+		SWAP(int, &r.max.x, &r.max.y);
+	}
 
-				nbsend(job->donec, nil);
-			}else if(job->rctl->doprof)
-				job->times.Rn[rp->id].t1 = nanosec();
+	/* make them left-to-right */
+	if(p0.x > p1.x){
+		SWAP(Point, &p0, &p1);
+		SWAP(BVertex, v+0, v+1);
+	}
+
+	if(!_rectclipline(r, p0, p1, &i0, &i1))
+		return;
+
+	Δx = p1.x - p0.x;
+	Δy = abs(p1.y - p0.y);
+	sy = p1.y < p0.y? -1: 1;
+
+	/* perspective divide vertex attributes */
+	_mulvertex(v+0, v[0].p.w);
+	_mulvertex(v+1, v[1].p.w);
+
+	/* per-step gradient and the first step's attributes */
+	t = Δx == 0? 0: 1.0/Δx;
+	memset(&∇, 0, sizeof ∇);
+	_berpvertex(steep? &∇.dy: &∇.dx, v+0, v+1, v+1, Vec3(-t, t, 0));
+	_berpvertex(sp->v, v+0, v+1, v+1, Vec3(1 - i0*t, i0*t, 0));
+
+	/* y offset and error term at the first step */
+	k = e = 0;
+	if(Δx > 0){
+		e = 2*(vlong)i0*Δy + Δx;
+		k = e/(2*Δx);
+		e -= k*2*Δx;
+	}
+
+	for(i = i0; i <= i1; i++){
+		p = (Point){p0.x + i, p0.y + sy*k};
+		sp->p = steep? (Point){p.y, p.x}: p;
+
+		/*
+		 * wireframe edges lie on the faces that filled the
+		 * z-buffer, so they have to pass when on a par with them.
+		 * they still leave their depth behind, for the skybox.
+		 */
+		if(ropts & ROWireframe){
+			z = getdepth(zr, sp->p);
+			if((!(ropts & RODepth) || sp->v->p.z + ε1 >= z)
+			&& shadefrag(sp, prim->mtl, ropts & ~(RODepth|ROWireframe), &∇)
+			&& sp->v->p.z > z)
+				putdepth(zr, sp->p, sp->v->p.z);
+		}else
+			shadefrag(sp, prim->mtl, ropts, &∇);
+		_addvertex(sp->v, steep? &∇.dy: &∇.dx);
+
+		e += 2*Δy;
+		if(e >= 2*Δx){
+			k++;
+			e -= 2*Δx;
+		}
+	}
+}
+
+static void
+rasterizetri(Rastertask *task)
+{
+	Shaderparams *sp;
+	Trisetup *s;
+	BVertex v0;
+	Rectangle r;
+	Point p, Δp;
+	Point3 bc, bc0;
+	uint ropts;
+
+	sp = task->fsp;
+	s = task->setup;
+
+	ropts = task->ropts;
+
+	r = s->bbox;
+	if(!rectclip(&r, task->wr))
+		return;
+
+	/* move the origin of the gradients to the first pixel */
+	Δp = subpt(r.min, s->bbox.min);
+	bc0 = s->∇.bc.p0;
+	bc0 = addpt3(bc0, mulpt3(s->∇.bc.dx, Δp.x));
+	bc0 = addpt3(bc0, mulpt3(s->∇.bc.dy, Δp.y));
+	v0 = s->∇.v.v0;
+	_maddvertex(&v0, &s->∇.v.dx, Δp.x);
+	_maddvertex(&v0, &s->∇.v.dy, Δp.y);
+
+	/* TODO find a good method to apply the fill rule (ROFixpt has one) */
+	for(p.y = r.min.y; p.y < r.max.y; p.y++){
+		bc = bc0;
+		*sp->v = v0;
+	for(p.x = r.min.x; p.x < r.max.x; p.x++){
+		if(bc.x < 0 || bc.y < 0 || bc.z < 0)
+			goto discard;
+
+		sp->p = p;
+		shadefrag(sp, s->mtl, ropts, &s->∇.v);
+discard:
+		bc = addpt3(bc, s->∇.bc.dx);
+		_addvertex(sp->v, &s->∇.v.dx);
+	}
+		bc0 = addpt3(bc0, s->∇.bc.dy);
+		_addvertex(&v0, &s->∇.v.dy);
+	}
+}
+
+/*
+ * trivially rejects (-1) or accepts (1) a block whose first pixel
+ * center has the edge values w.  partially covered blocks (0) need
+ * a per-pixel coverage test.
+ */
+static int
+classifyblock(Rectangle b, vlong w[3], vlong Δwx[3], vlong Δwy[3])
+{
+	vlong ex, ey;
+	int i, in;
+
+	in = 1;
+	for(i = 0; i < 3; i++){
+		ex = (Dx(b)-1)*Δwx[i];
+		ey = (Dy(b)-1)*Δwy[i];
+		if(w[i] + max(ex, 0) + max(ey, 0) < 0)
+			return -1;
+		if(w[i] + min(ex, 0) + min(ey, 0) < 0)
+			in = 0;
+	}
+	return in;
+}
+
+/*
+ * fixed-point edge function rasterizer
+ *
+ * the bounding box is walked in BLKSZ×BLKSZ blocks that are
+ * classified against the edges first, skipping the empty ones and
+ * filling the ones fully inside without testing every pixel.
+ *
+ * references:
+ * 	- “A Parallel Algorithm for Polygon Rasterization”, Juan Pineda, SIGGRAPH '88, pp. 17-20
+ * 	- “Incremental and Hierarchical Hilbert Order Edge Equation Polygon Rasterization”, McCool et al., Graphics Hardware 2001
+ * 	- https://fgiesen.wordpress.com/2013/02/08/triangle-rasterization-in-practice/
+ */
+static void
+rasterizetrifx(Rastertask *task)
+{
+	Shaderparams *sp;
+	Trisetup *s;
+	BVertex bv;
+	Rectangle r, b;
+	Point p;
+	vlong px, py;
+	vlong w0[3], wb[3], w[3], wrow[3], Δwx[3], Δwy[3];
+	uint ropts;
+	int i, cov;
+
+	sp = task->fsp;
+	s = task->setup;
+
+	ropts = task->ropts;
+
+	r = s->bbox;
+	if(!rectclip(&r, task->wr))
+		return;
+
+	/* evaluate the edge functions at the bbox's first pixel center */
+	px = (vlong)s->bbox.min.x*FXONE + FXHALF;
+	py = (vlong)s->bbox.min.y*FXONE + FXHALF;
+	for(i = 0; i < 3; i++){
+		w0[i] = s->e[i].a*px + s->e[i].b*py + s->e[i].c;
+		Δwx[i] = s->e[i].a*FXONE;
+		Δwy[i] = s->e[i].b*FXONE;
+	}
+
+	for(b.min.y = r.min.y; b.min.y < r.max.y; b.min.y = b.max.y){
+		b.max.y = min((b.min.y & ~(BLKSZ-1)) + BLKSZ, r.max.y);
+	for(b.min.x = r.min.x; b.min.x < r.max.x; b.min.x = b.max.x){
+		b.max.x = min((b.min.x & ~(BLKSZ-1)) + BLKSZ, r.max.x);
+
+		for(i = 0; i < 3; i++)
+			wb[i] = w0[i] + (b.min.x - s->bbox.min.x)*Δwx[i] + (b.min.y - s->bbox.min.y)*Δwy[i];
+
+		cov = classifyblock(b, wb, Δwx, Δwy);
+		if(cov < 0)
 			continue;
+
+		bv = s->∇.v.v0;
+		_maddvertex(&bv, &s->∇.v.dx, b.min.x - s->bbox.min.x);
+		_maddvertex(&bv, &s->∇.v.dy, b.min.y - s->bbox.min.y);
+
+		if(cov > 0){
+			for(p.y = b.min.y; p.y < b.max.y; p.y++){
+				*sp->v = bv;
+			for(p.x = b.min.x; p.x < b.max.x; p.x++){
+				sp->p = p;
+				shadefrag(sp, s->mtl, ropts, &s->∇.v);
+				_addvertex(sp->v, &s->∇.v.dx);
+			}
+				_addvertex(&bv, &s->∇.v.dy);
+			}
+			continue;
+		}
+
+		memmove(wrow, wb, sizeof wrow);
+		for(p.y = b.min.y; p.y < b.max.y; p.y++){
+			memmove(w, wrow, sizeof w);
+			*sp->v = bv;
+		for(p.x = b.min.x; p.x < b.max.x; p.x++){
+			if((w[0] | w[1] | w[2]) >= 0){
+				sp->p = p;
+				shadefrag(sp, s->mtl, ropts, &s->∇.v);
+			}
+			w[0] += Δwx[0];
+			w[1] += Δwx[1];
+			w[2] += Δwx[2];
+			_addvertex(sp->v, &s->∇.v.dx);
+		}
+			wrow[0] += Δwy[0];
+			wrow[1] += Δwy[1];
+			wrow[2] += Δwy[2];
+			_addvertex(&bv, &s->∇.v.dy);
+		}
+	}
+	}
+}
+
+/* files the task under every tile touched by bbox, which must be within fbr */
+static void
+bintask(Tilebin *bins, Arena *a, Rectangle fbr, Rectangle bbox, Rastertask *task)
+{
+	Tilebin *bin;
+	Binblk *b;
+	Point grid;
+	int x, y, x0, y0, x1, y1;
+
+	grid = _tilegrid(fbr);
+	x0 = (bbox.min.x - fbr.min.x)/TILESZ;
+	y0 = (bbox.min.y - fbr.min.y)/TILESZ;
+	x1 = (bbox.max.x-1 - fbr.min.x)/TILESZ;
+	y1 = (bbox.max.y-1 - fbr.min.y)/TILESZ;
+
+	for(y = y0; y <= y1; y++)
+	for(x = x0; x <= x1; x++){
+		bin = &bins[y*grid.x + x];
+		b = bin->last;
+		if(b == nil || b->n == nelem(b->t)){
+			b = _arenaalloc(a, sizeof *b);
+			b->next = nil;
+			b->n = 0;
+			if(bin->last == nil)
+				bin->first = b;
+			else
+				bin->last->next = b;
+			bin->last = b;
 		}
+		b->t[b->n++] = *task;
+	}
+}
+
+static void
+allocjobbufs(Renderjob *job, ulong nproc)
+{
+	Point grid;
+	ulong ntiles;
+	int i;
+
+	grid = _tilegrid(job->fb->r);
+	ntiles = grid.x*grid.y;
+
+	job->arenas = _emalloc((nproc+1)*sizeof(Arena*));
+	job->bins = _emalloc(nproc*sizeof(Tilebin*));
+	job->tileqs = _emalloc(nproc*sizeof(Tileq));
+	for(i = 0; i < nproc; i++){
+		job->arenas[i] = _allocarena(ARENABLKSZ);
+		job->bins[i] = _emalloc(ntiles*sizeof(Tilebin));
+		memset(job->bins[i], 0, ntiles*sizeof(Tilebin));
+		job->tileqs[i].next = 0;
+		job->tileqs[i].n = i < ntiles? (ntiles - i + nproc-1)/nproc: 0;
+	}
+	job->arenas[i] = nil;
+}
+
+static void
+freejobbufs(Renderjob *job)
+{
+	int i;
+
+	if(job->arenas == nil)
+		return;
+	for(i = 0; job->arenas[i] != nil; i++){
+		_freearena(job->arenas[i]);
+		free(job->bins[i]);
+	}
+	free(job->arenas);
+	free(job->bins);
+	free(job->tileqs);
+	job->arenas = nil;
+	job->bins = nil;
+	job->tileqs = nil;
+}
+
+static void
+rasterize(Rasterparam *rp, Shaderparams *fsp, Rastertask *task)
+{
+	static void(*rasterfn[])(Rastertask*) = {
+	 [PPoint]	rasterizept,
+	 [PLine]	rasterizeline,
+	};
+	Renderjob *job;
 
-		fsp.fb = task.job->fb;
-		fsp.camera = task.job->camera;
-		fsp.entity = task.entity;
-		fsp.scene = task.job->camera->scene;
-		task.fsp = &fsp;
-		(*rasterfn[task.p.type])(&task);
+	job = task->job;
+	if(job->rctl->doprof && job->times.Rn[rp->id].t0 == 0)
+		job->times.Rn[rp->id].t0 = nanosec();
+
+	fsp->fb = job->fb;
+	fsp->camera = job->camera;
+	fsp->entity = task->entity;
+	fsp->scene = job->camera->scene;
+	task->fsp = fsp;
+	if(task->setup != nil){
+		if(fsp->camera->rendopts & ROFixpt)
+			rasterizetrifx(task);
+		else
+			rasterizetri(task);
+		return;
 	}
+	(*rasterfn[task->p->type])(task);
 }
 
+/* world space direction of the view ray through the viewport point (x,y) */
+static Point3
+viewray(Camera *c, Framebuf *fb, double x, double y)
+{
+	Point3 n, f;
+
+	n = ndc2vcs(c, viewport2ndc(fb, Pt3(x, y, 1, 1)));
+	f = ndc2vcs(c, viewport2ndc(fb, Pt3(x, y, 0, 1)));
+	return vcs2world(c, subpt3(f, n));
+}
+
+/*
+ * fills the pixels of the tile that are still at the cleared
+ * depth with the scene's skybox.  the view rays change linearly
+ * across the viewport, so they are stepped instead of being
+ * unprojected for every pixel.
+ */
 static void
-initworkrects(Rectangle *wr, int nwr, Rectangle *fbr)
+drawskybox(Renderjob *job, Rectangle r)
 {
-	int i, Δy;
+	Camera *c;
+	Raster *cr, *zr;
+	Point3 d0, ddx, ddy, drow, d;
+	Point p;
+
+	c = job->camera;
+	cr = job->fb->rasters;
+	zr = cr->next;
 
-	wr[0] = *fbr;
-	Δy = Dy(wr[0])/nwr;
-	wr[0].max.y = wr[0].min.y + Δy;
-	for(i = 1; i < nwr; i++)
-		wr[i] = rectaddpt(wr[i-1], Pt(0,Δy));
-	if(wr[nwr-1].max.y < fbr->max.y)
-		wr[nwr-1].max.y = fbr->max.y;
+	d0 = viewray(c, job->fb, r.min.x+0.5, r.min.y+0.5);
+	ddx = subpt3(viewray(c, job->fb, r.min.x+1.5, r.min.y+0.5), d0);
+	ddy = subpt3(viewray(c, job->fb, r.min.x+0.5, r.min.y+1.5), d0);
+
+	drow = d0;
+	for(p.y = r.min.y; p.y < r.max.y; p.y++){
+		d = drow;
+	for(p.x = r.min.x; p.x < r.max.x; p.x++){
+		if(isInf(getdepth(zr, p), -1))
+			pixel(cr, p, samplecubemap(c->scene->skybox, d, neartexsampler), 0);
+		d = addpt3(d, ddx);
+	}
+		drow = addpt3(drow, ddy);
+	}
+}
+
+static int
+claimtile(Tileq *q)
+{
+	long k;
+
+	if(q->next >= q->n)
+		return -1;
+	k = ainc(&q->next)-1;
+	return k < q->n? k: -1;
+}
+
+/*
+ * rasterizes the tiles in our own queue first, and then helps
+ * the others with what's left of theirs.
+ */
+static void
+rastertiles(Rasterparam *rp, Shaderparams *fsp, Renderjob *job)
+{
+	Rastertask task;
+	Binblk *b;
+	Rectangle r;
+	Point grid;
+	ulong nproc;
+	int i, j, k, n, t, tiler, hidelines, wblend, pass, touched;
+
+	nproc = rp->nproc;
+	grid = _tilegrid(job->fb->r);
+	hidelines = (job->camera->rendopts & (ROWireframe|RODepth)) == (ROWireframe|RODepth);
+	wblend = (job->camera->rendopts & (ROWblend|ROAbuff|ROKbuff)) == ROWblend;
+	for(i = 0; i < nproc; i++){
+		j = (rp->id + i) % nproc;
+		while((k = claimtile(&job->tileqs[j])) >= 0){
+			t = j + k*nproc;
+			r = _tilerect(job->fb->r, grid, t);
+
+			/* the last reset left it to us, while it's in the cache */
+			if(job->fb->tiles[t] & TClear)
+				_cleartile(job->fb, t);
+
+			touched = job->camera->scene->skybox != nil;
+			for(tiler = 0; tiler < nproc; tiler++)
+				touched |= job->bins[tiler][t].first != nil;
+			if(touched)
+				job->fb->tiles[t] |= TDirty;
+
+			/*
+			 * for hidden-line removal the faces go first, then the
+			 * edges.  with weighted blending the opaque fragments
+			 * go before the translucent ones, so that those behind
+			 * them can be depth-tested away.
+			 */
+			for(pass = hidelines? 0: 1; pass < (wblend? 3: 2); pass++)
+			for(tiler = 0; tiler < nproc; tiler++)
+			for(b = job->bins[tiler][t].first; b != nil; b = b->next)
+				for(n = 0; n < b->n; n++){
+					task = b->t[n];
+					if(hidelines && (task.setup != nil) != (pass == 0))
+						continue;
+					task.wr = r;
+					task.ropts = job->camera->rendopts;
+					if(wblend)
+						task.ropts |= pass == 2? ROTransl: ROOpaque;
+					rasterize(rp, fsp, &task);
+				}
+
+			/* the sky goes behind the opaque depth, under any translucency */
+			if(job->camera->scene->skybox != nil)
+				drawskybox(job, r);
+			if(job->camera->rendopts & ROAbuff)
+				squashAbuf(job->fb, &r, job->camera->rendopts & ROBlend);
+			else if(job->camera->rendopts & ROKbuff)
+				squashKbuf(job->fb, &r, job->camera->rendopts & ROBlend);
+			else if(wblend)
+				squashWblend(job->fb, &r, job->camera->rendopts & ROBlend);
+		}
+	}
+}
+
+static void
+endjob(Rasterparam *rp, Renderjob *job)
+{
+	if(job->rctl->doprof && job->times.Rn[rp->id].t0 == 0)
+		job->times.Rn[rp->id].t0 = nanosec();
+
+	if(decref(job) == 0){
+		freejobbufs(job);
+		if(job->rctl->doprof)
+			job->times.Rn[rp->id].t1 = nanosec();
+
+		nbsend(job->donec, nil);
+	}else if(job->rctl->doprof)
+		job->times.Rn[rp->id].t1 = nanosec();
+}
+
+/*
+ * a job is sent to us by the last tiler to finish it, once all the
+ * bins are filled.  the tiles are then up for grabs.
+ */
+static void
+rasterizer(void *arg)
+{
+	Rasterparam *rp;
+	Renderjob *job;
+	BVertex v;
+	Shaderparams fsp;
+
+	rp = arg;
+	threadsetname("rasterizer %d", rp->id);
+
+	memset(&fsp, 0, sizeof fsp);
+	fsp.v = &v;
+	fsp.getuniform = sparams_getuniform;
+	fsp.getattr = sparams_getattr;
+	fsp.toraster = sparams_toraster;
+
+	while((job = recvp(rp->jobc)) != nil){
+		rastertiles(rp, &fsp, job);
+		endjob(rp, job);
+	}
 }
 
 static BPrimitive *
@@ -576,6 +1444,9 @@ assembleprim(BPrimitive *d, Primitive *s, Model *m)
 
 	memset(d, 0, sizeof *d);
 	d->type = s->type;
+	d->edge[0] = 0;
+	d->edge[1] = 1;
+	d->edge[2] = 2;
 	if(s->tangent != NaI){
 		p3 = bunchget(m->tangents, s->tangent);
 		if(p3 != nil)
@@ -586,7 +1457,7 @@ assembleprim(BPrimitive *d, Primitive *s, Model *m)
 		d->mtl = &defmtl;
 	else{
 		d->mtl = bunchget(m->materials, s->mtl);
-		if(d->mtl == nil || d->mtl->shaders == nil)
+		if(d->mtl == nil)
 			d->mtl = &defmtl;
 	}
 
@@ -626,171 +1497,376 @@ assembleprim(BPrimitive *d, Primitive *s, Model *m)
 	return d;
 }
 
+/*
+ * a vertex is usually shared by several of the model's primitives,
+ * and the shader's output only depends on the vertex itself, the
+ * material and the tangent, so it's kept in a small direct-mapped
+ * cache to run it only once per vertex, most of the time.
+ *
+ * references:
+ * 	- “Optimization of Mesh Locality for Transparent Vertex Caching”, Hugues Hoppe, SIGGRAPH '99, pp. 269-276
+ */
 static void
-tiler(void *arg)
+shadeverts(Tilerparam *tp, Shaderparams *vsp, Renderjob *job, BPrimitive *p, Primitive *ep)
 {
-	Tilerparam *tp;
-	Tilertask task;
-	Rastertask rtask;
-	Shaderparams vsp;
-	Primitive *ep;			/* primitives to raster */
-	BPrimitive prim, *p, *cp;
-	Rectangle *wr, bbox;
-	Channel **taskchans;
-	ulong nproc;
-	int i, np;
+	Vcentry *ce;
+	ulong vi;
+	int i;
 
-	tp = arg;
-	threadsetname("tiler %d", tp->id);
+	for(i = 0; i < p->type+1; i++){
+		vi = ep->v[i];
+		ce = &tp->vcache[(vi ^ (uintptr)vsp->entity>>4) & VCACHESZ-1];
+		if(ce->ent == vsp->entity && ce->vi == vi
+		&& ce->jobid == job->id && ce->mtl == p->mtl && ce->tangent == ep->tangent){
+			p->v[i] = ce->v;
+			continue;
+		}
 
-	cp = _emalloc(16*sizeof(*cp));
-	taskchans = tp->taskchans;
-	nproc = tp->nproc;
-	wr = _emalloc(nproc*sizeof(Rectangle));
+		vsp->v = &p->v[i];
+		vsp->idx = i;
+		vsp->vidx = vi;
+		p->v[i].p = getshaders(p->mtl)->vs(vsp);
+
+		ce->jobid = job->id;
+		ce->ent = vsp->entity;
+		ce->vi = vi;
+		ce->tangent = ep->tangent;
+		ce->mtl = p->mtl;
+		ce->v = p->v[i];
+	}
+}
 
-	memset(&vsp, 0, sizeof vsp);
-	vsp.getuniform = sparams_getuniform;
-	vsp.getattr = sparams_getattr;
-	vsp.setattr = sparams_setattr;
+/* bins the a→b line, taking everything else from p */
+static void
+binline(Tilebin *bins, Arena *arena, Rectangle fbr, Rastertask *rtask, BPrimitive *p, BVertex *a, BVertex *b)
+{
+	BPrimitive *l;
+	Rectangle bbox;
 
-	while(recv(tp->taskc, &task) > 0){
-		if(task.job->rctl->doprof
-		&& task.job->times.Tn[tp->id].t0 == 0)
-			task.job->times.Tn[tp->id].t0 = nanosec();
+	bbox.min.x = min(a->p.x, b->p.x);
+	bbox.min.y = min(a->p.y, b->p.y);
+	bbox.max.x = max(a->p.x, b->p.x)+1;
+	bbox.max.y = max(a->p.y, b->p.y)+1;
 
-		rtask.Commontask = task.Commontask;
-		if(task.islast){
-			if(task.job->rctl->doprof)
-				task.job->times.Tn[tp->id].t1 = nanosec();
+	if(!rectclip(&bbox, fbr))
+		return;
 
-			if(decref(task.job) == 0){
-				if(task.job->camera->rendopts & ROAbuff)
-					initworkrects(wr, nproc, &task.job->fb->r);
+	l = _arenaalloc(arena, sizeof *l);
+	*l = *p;
+	l->type = PLine;
+	l->v[0] = *a;
+	l->v[1] = *b;
+	rtask->p = l;
+	rtask->setup = nil;
+	bintask(bins, arena, fbr, bbox, rtask);
+}
 
-				task.job->ref = nproc;
-				for(i = 0; i < nproc; i++){
-					if(task.job->camera->rendopts & ROAbuff)
-						rtask.wr = wr[i];
-					send(taskchans[i], &rtask);
-				}
-			}
+/*
+ * an edge shared by two triangles is drawn by the first one to
+ * claim it, among those that make it past culling.
+ */
+static int
+claimedge(int *bits, ulong *edges, int k)
+{
+	ulong e;
+	int *w, o, b;
+
+	if(k < 0)
+		return 0;	/* made by clipping */
+	e = edges[k];
+	if(e == NaI)
+		return 1;
+	w = &bits[e/32];
+	b = 1<<(e%32);
+	do{
+		o = *w;
+		if(o & b)
+			return 0;
+	}while(!cas(w, o, o|b));
+	return 1;
+}
+
+static void
+tileprims(Tilerparam *tp, Shaderparams *vsp, Rastertask *rtask, BPrimitive *cp, Primitive *eb, Primitive *ee, int *edgebits)
+{
+	Primitive *ep;
+	BPrimitive prim, *p;
+	Trisetup *ts;
+	Arena *arena;
+	Tilebin *bins;
+	Rectangle bbox;
+	ulong *edges;
+	uint ropts;
+	int oc[3], np, i;
+
+	arena = rtask->job->arenas[tp->id];
+	bins = rtask->job->bins[tp->id];
+	ropts = vsp->camera->rendopts;
+	ts = nil;	/* left over from a rejected triangle */
+	edges = nil;
+
+	for(ep = eb; ep != ee; ep++){
+		np = 1;	/* start with one. after clipping it might change */
+
+		p = assembleprim(&prim, ep, vsp->entity->mdl);
+		if(p == nil){
+			fprint(2, "malformed primitive #%zd ent %s mdl %s\n",
+				ep - (Primitive*)vsp->entity->mdl->prims->items,
+				vsp->entity->name, vsp->entity->mdl->name);
 			continue;
 		}
-		vsp.fb = task.job->fb;
-		vsp.camera = task.job->camera;
-		vsp.entity = task.entity;
-		vsp.scene = task.job->camera->scene;
 
-		initworkrects(wr, nproc, &vsp.fb->r);
+		shadeverts(tp, vsp, rtask->job, p, ep);
 
-		for(ep = task.eb; ep != task.ee; ep++){
-			np = 1;	/* start with one. after clipping it might change */
+		switch(p->type){
+		case PPoint:
+			if(!isvisible(p->v[0].p))
+				break;
 
-			p = assembleprim(&prim, ep, vsp.entity->mdl);
-			if(p == nil){
-				fprint(2, "malformed primitive #%zd ent %s mdl %s\n",
-					ep - (Primitive*)vsp.entity->mdl->prims->items,
-					vsp.entity->name, vsp.entity->mdl->name);
-				continue;
-			}
+			p->v[0].p = clip2ndc(p->v[0].p);
+			p->v[0].p = ndc2viewport(vsp->fb, p->v[0].p);
 
-			switch(p->type){
-			case PPoint:
-				vsp.v = &p->v[0];
-				vsp.idx = 0;
-				p->v[0].p = p->mtl->shaders->vs(&vsp);
+			bbox.min.x = p->v[0].p.x;
+			bbox.min.y = p->v[0].p.y;
+			bbox.max = addpt(bbox.min, Pt(1,1));
+			if(!ptinrect(bbox.min, vsp->fb->r))
+				break;
 
-				if(!isvisible(p->v[0].p))
+			rtask->p = _arenaalloc(arena, sizeof *rtask->p);
+			*rtask->p = *p;
+			rtask->setup = nil;
+			bintask(bins, arena, vsp->fb->r, bbox, rtask);
+			break;
+		case PLine:
+			if(!isvisible(p->v[0].p) || !isvisible(p->v[1].p)){
+				np = _clipprimitive(p, cp);
+				if(np < 1)
 					break;
+				p = cp;
+			}
 
-				p->v[0].p = clip2ndc(p->v[0].p);
-				p->v[0].p = ndc2viewport(vsp.fb, p->v[0].p);
-
-				bbox.min.x = p->v[0].p.x;
-				bbox.min.y = p->v[0].p.y;
+			p->v[0].p = clip2ndc(p->v[0].p);
+			p->v[1].p = clip2ndc(p->v[1].p);
+			p->v[0].p = ndc2viewport(vsp->fb, p->v[0].p);
+			p->v[1].p = ndc2viewport(vsp->fb, p->v[1].p);
 
-				for(i = 0; i < nproc; i++)
-					if(ptinrect(bbox.min, wr[i])){
-						rtask.p = *p;
-						send(taskchans[i], &rtask);
-						break;
-					}
+			binline(bins, arena, vsp->fb->r, rtask, p, &p->v[0], &p->v[1]);
+			break;
+		case PTriangle:
+			if(ropts & ROWireframe)
+				edges = vsp->entity->mdl->edges->ids + 3*(ep - (Primitive*)vsp->entity->mdl->prims->items);
+
+			oc[0] = outcode(p->v[0].p);
+			oc[1] = outcode(p->v[1].p);
+			oc[2] = outcode(p->v[2].p);
+			if(oc[0] & oc[1] & oc[2])
 				break;
-			case PLine:
-				for(i = 0; i < 2; i++){
-					vsp.v = &p->v[i];
-					vsp.idx = i;
-					p->v[i].p = p->mtl->shaders->vs(&vsp);
-				}
 
-				if(!isvisible(p->v[0].p) || !isvisible(p->v[1].p)){
-					np = _clipprimitive(p, cp);
-					if(np < 1)
-						break;
-					p = cp;
-				}
+			/*
+			 * in guard-band mode, triangles that only cross the
+			 * sides of the frustum, without going past the guard
+			 * band, are left for the tile scissor to trim instead.
+			 */
+			if((oc[0] | oc[1] | oc[2]) & (ropts & ROGuard? OCFAR|OCNEAR|OCGUARD: ~0)){
+				np = _cliptriangle(p, cp);
+				p = cp;
+			}
 
+			for(i = 0; i < np; i++, p++){
 				p->v[0].p = clip2ndc(p->v[0].p);
 				p->v[1].p = clip2ndc(p->v[1].p);
-				p->v[0].p = ndc2viewport(vsp.fb, p->v[0].p);
-				p->v[1].p = ndc2viewport(vsp.fb, p->v[1].p);
-
-				bbox.min.x = min(p->v[0].p.x, p->v[1].p.x);
-				bbox.min.y = min(p->v[0].p.y, p->v[1].p.y);
-				bbox.max.x = max(p->v[0].p.x, p->v[1].p.x)+1;
-				bbox.max.y = max(p->v[0].p.y, p->v[1].p.y)+1;
+				p->v[2].p = clip2ndc(p->v[2].p);
 
-				for(i = 0; i < nproc; i++)
-					if(RECTXRECT(bbox, wr[i])){
-						rtask.wr = wr[i];
-						rtask.p = *p;
-						send(taskchans[i], &rtask);
-					}
-				break;
-			case PTriangle:
-				for(i = 0; i < 3; i++){
-					vsp.v = &p->v[i];
-					vsp.idx = i;
-					p->v[i].p = p->mtl->shaders->vs(&vsp);
+				/* culling */
+				if(isfacingback(p)){
+					if(vsp->camera->cullmode == CullBack)
+						continue;
+				}else if(vsp->camera->cullmode == CullFront)
+					continue;
+
+				p->v[0].p = ndc2viewport(vsp->fb, p->v[0].p);
+				p->v[1].p = ndc2viewport(vsp->fb, p->v[1].p);
+				p->v[2].p = ndc2viewport(vsp->fb, p->v[2].p);
+
+				/*
+				 * only the model's own edges are drawn, once
+				 * each.  the faces are kept just for hidden-line
+				 * removal.
+				 */
+				if(ropts & ROWireframe){
+					if(claimedge(edgebits, edges, p->edge[0]))
+						binline(bins, arena, vsp->fb->r, rtask, p, &p->v[0], &p->v[1]);
+					if(claimedge(edgebits, edges, p->edge[1]))
+						binline(bins, arena, vsp->fb->r, rtask, p, &p->v[1], &p->v[2]);
+					if(claimedge(edgebits, edges, p->edge[2]))
+						binline(bins, arena, vsp->fb->r, rtask, p, &p->v[2], &p->v[0]);
+					if((ropts & RODepth) == 0)
+						continue;
 				}
 
-				if(!isvisible(p->v[0].p) || !isvisible(p->v[1].p) || !isvisible(p->v[2].p)){
-					np = _clipprimitive(p, cp);
-					p = cp;
-				}
+				if(ts == nil)
+					ts = _arenaalloc(arena, sizeof *ts);
+				if(setuptri(ts, p, vsp->fb->r) < 0)
+					continue;
+
+				rtask->p = nil;
+				rtask->setup = ts;
+				bintask(bins, arena, vsp->fb->r, ts->bbox, rtask);
+				ts = nil;
+			}
+			break;
+		default: sysfatal("alien primitive detected");
+		}
+	}
+}
 
-				for(; np--; p++){
-					p->v[0].p = clip2ndc(p->v[0].p);
-					p->v[1].p = clip2ndc(p->v[1].p);
-					p->v[2].p = clip2ndc(p->v[2].p);
+static Primq *
+allocprimq(void)
+{
+	Primq *q;
 
-					/* culling */
-					if(isfacingback(p)){
-						if(vsp.camera->cullmode == CullBack)
-							continue;
-					}else if(vsp.camera->cullmode == CullFront)
-						continue;
+	q = _emalloc(sizeof *q);
+	memset(q, 0, sizeof *q);
+	q->first = _emalloc(sizeof(ulong));
+	q->first[0] = 0;
+	return q;
+}
 
-					p->v[0].p = ndc2viewport(vsp.fb, p->v[0].p);
-					p->v[1].p = ndc2viewport(vsp.fb, p->v[1].p);
-					p->v[2].p = ndc2viewport(vsp.fb, p->v[2].p);
-
-					bbox.min.x = min(min(p->v[0].p.x, p->v[1].p.x), p->v[2].p.x);
-					bbox.min.y = min(min(p->v[0].p.y, p->v[1].p.y), p->v[2].p.y);
-					bbox.max.x = max(max(p->v[0].p.x, p->v[1].p.x), p->v[2].p.x)+1;
-					bbox.max.y = max(max(p->v[0].p.y, p->v[1].p.y), p->v[2].p.y)+1;
-
-					for(i = 0; i < nproc; i++)
-						if(RECTXRECT(bbox, wr[i])){
-							rtask.wr = wr[i];
-							rtask.p = *p;
-							send(taskchans[i], &rtask);
-						}
+static void
+primqadd(Primq *q, Entity *e, int wireframe)
+{
+	usize n;
+
+	if(q->nents % 16 == 0){
+		q->ents = _erealloc(q->ents, (q->nents + 16)*sizeof(Entity*));
+		q->first = _erealloc(q->first, (q->nents + 16 + 1)*sizeof(ulong));
+		q->edgebits = _erealloc(q->edgebits, (q->nents + 16)*sizeof(int*));
+	}
+	q->edgebits[q->nents] = nil;
+	if(wireframe){
+		n = (_modeledges(e->mdl)->n + 31)/32*sizeof(int);
+		q->edgebits[q->nents] = _emalloc(n);
+		memset(q->edgebits[q->nents], 0, n);
+	}
+	q->first[q->nents+1] = q->first[q->nents] + e->mdl->prims->nitems;
+	q->ents[q->nents++] = e;
+}
+
+static void
+freeprimq(Primq *q)
+{
+	ulong i;
+
+	for(i = 0; i < q->nents; i++)
+		free(q->edgebits[i]);
+	free(q->edgebits);
+	free(q->ents);
+	free(q->first);
+	free(q);
+}
+
+/* the entity primitive g belongs to */
+static int
+findent(Primq *q, ulong g)
+{
+	int lo, hi, m;
+
+	lo = 0;
+	hi = q->nents;
+	while(hi - lo > 1){
+		m = (lo + hi)/2;
+		if(q->first[m] <= g)
+			lo = m;
+		else
+			hi = m;
+	}
+	return lo;
+}
+
+/*
+ * each batch of the job's primitives is handed out in chunks of
+ * CHUNKSZ, regardless of which entity they belong to, until there
+ * are no more left.  the job is done after its last batch.
+ */
+static void
+tiler(void *arg)
+{
+	Tilerparam *tp;
+	Tilertask task, *tasks;
+	Rastertask rtask;
+	Shaderparams vsp;
+	Primq *q;
+	Primitive *prims;
+	BPrimitive *cp;
+	Channel **rjobcs;
+	void *vp;
+	ulong nproc, n, j, g, ge, ne;
+	long k;
+	int i, e;
+
+	tp = arg;
+	threadsetname("tiler %d", tp->id);
+
+	cp = _emalloc(16*sizeof(*cp));
+	tp->vcache = _emalloc(VCACHESZ*sizeof(Vcentry));
+	memset(tp->vcache, 0, VCACHESZ*sizeof(Vcentry));
+	rjobcs = tp->rjobcs;
+	nproc = tp->nproc;
+
+	memset(&vsp, 0, sizeof vsp);
+	vsp.getuniform = sparams_getuniform;
+	vsp.getattr = sparams_getattr;
+	vsp.setattr = sparams_setattr;
+
+	for(;;){
+		if((n = _ringget(tp->taskq, &vp)) == 0){
+			_ringwait(&tp->w, &tp->taskq, 1);
+			continue;
+		}
+
+		tasks = vp;
+		for(j = 0; j < n; j++){
+			task = tasks[j];
+			if(task.job->rctl->doprof
+			&& task.job->times.Tn[tp->id].t0 == 0)
+				task.job->times.Tn[tp->id].t0 = nanosec();
+
+			vsp.fb = task.job->fb;
+			vsp.camera = task.job->camera;
+			vsp.scene = task.job->camera->scene;
+
+			memset(&rtask, 0, sizeof rtask);
+			rtask.job = task.job;
+
+			q = task.q;
+			while((k = ainc(&q->next)-1) < q->nchunks){
+				g = k*CHUNKSZ;
+				ge = min(g + CHUNKSZ, q->nprims);
+				for(e = findent(q, g); g < ge; e++){
+					prims = q->ents[e]->mdl->prims->items;
+					vsp.entity = rtask.entity = q->ents[e];
+					ne = min(ge, q->first[e+1]);
+					tileprims(tp, &vsp, &rtask, cp, prims + (g - q->first[e]), prims + (ne - q->first[e]), q->edgebits[e]);
+					g = ne;
 				}
-				break;
-			default: sysfatal("alien primitive detected");
+			}
+
+			if(task.job->rctl->doprof)
+				task.job->times.Tn[tp->id].t1 = nanosec();
+
+			if(decref(q) == 0)
+				freeprimq(q);
+			if(!task.islast)
+				continue;
+
+			/* the last one to finish lets the rasterizers in */
+			if(decref(task.job) == 0){
+				task.job->ref = nproc;
+				for(i = 0; i < nproc; i++)
+					sendp(rjobcs[i], task.job);
 			}
 		}
+		_ringrelease(tp->taskq, n);
 	}
 }
 
@@ -798,15 +1874,14 @@ static void
 entityproc(void *arg)
 {
 	Entityparam *ep;
-	Channel **ttaskchans;
-	Channel **rtaskchans;
+	Ring **ttaskqs;
 	Tilerparam *tp;
-	Rasterparam *rp;
+	Rasterparam *rp, **rps;
 	Entitytask task;
 	Tilertask ttask;
-	Primitive *eb, *ee;
-	ulong stride, nprims, nproc, nworkers;
-	int i;
+	Primq *q;
+	ulong nproc;
+	int i, j;
 
 	threadsetname("entityproc");
 
@@ -816,23 +1891,32 @@ entityproc(void *arg)
 	if(nproc > 2)
 		nproc /= 2;
 
-	ttaskchans = _emalloc(nproc*sizeof(Channel*));
-	rtaskchans = _emalloc(nproc*sizeof(Channel*));
+	/* any tiler can hand a job to any rasterizer */
+	rps = _emalloc(nproc*sizeof(Rasterparam*));
+	for(i = 0; i < nproc; i++){
+		rp = rps[i] = _emalloc(sizeof *rp);
+		memset(rp, 0, sizeof *rp);
+		rp->id = i;
+		rp->jobc = chancreate(sizeof(Renderjob*), 8);
+		rp->nproc = nproc;
+	}
+	ttaskqs = _emalloc(nproc*sizeof(Ring*));
 	for(i = 0; i < nproc; i++){
 		tp = _emalloc(sizeof *tp);
+		memset(tp, 0, sizeof *tp);
 		tp->id = i;
-		tp->taskc = ttaskchans[i] = chancreate(sizeof(Tilertask), 256);
-		tp->taskchans = rtaskchans;
+		tp->taskq = ttaskqs[i] = _allocring(8, sizeof(Tilertask), &tp->w);
+		tp->rjobcs = _emalloc(nproc*sizeof(Channel*));
+		for(j = 0; j < nproc; j++)
+			tp->rjobcs[j] = rps[j]->jobc;
 		tp->nproc = nproc;
 		proccreate(tiler, tp, TILESTKSZ);
 	}
-	for(i = 0; i < nproc; i++){
-		rp = _emalloc(sizeof *rp);
-		rp->id = i;
-		rp->taskc = rtaskchans[i] = chancreate(sizeof(Rastertask), 2048);
-		proccreate(rasterizer, rp, PROCSTKSZ);
-	}
+	for(i = 0; i < nproc; i++)
+		proccreate(rasterizer, rps[i], PROCSTKSZ);
+	free(rps);
 
+	q = nil;
 	while(recv(ep->taskc, &task) > 0){
 		if(task.job->rctl->doprof && task.job->times.E.t0 == 0)
 			task.job->times.E.t0 = nanosec();
@@ -846,36 +1930,60 @@ entityproc(void *arg)
 			memset(task.job->times.Rn, 0, nproc*sizeof(Rendertime));
 		}
 
-		ttask.Commontask = task.Commontask;
-		if(task.islast){
+		/* arenas and bins for the tilers, given back by the last rasterizer */
+		if(task.job->arenas == nil)
+			allocjobbufs(task.job, nproc);
+
+		if(q == nil)
+			q = allocprimq();
+
+		/*
+		 * the tilers get to work as soon as there's enough for
+		 * all of them, while the rest of the job comes in.
+		 */
+		if(!task.islast){
+			primqadd(q, task.entity, task.job->camera->rendopts & ROWireframe);
+			if(q->first[q->nents] < nproc*QBATCH*CHUNKSZ)
+				continue;
+		}else
 			task.job->ref = nproc;
-			for(i = 0; i < nproc; i++)
-				send(ttaskchans[i], &ttask);
-			if(task.job->rctl->doprof)
-				task.job->times.E.t1 = nanosec();
-			continue;
-		}
 
-		eb = task.entity->mdl->prims->items;
-		nprims = task.entity->mdl->prims->nitems;
-		ee = eb + nprims;
+		q->nprims = q->first[q->nents];
+		q->nchunks = (q->nprims + CHUNKSZ-1)/CHUNKSZ;
+		q->ref = nproc;
 
-		if(nprims <= nproc){
-			nworkers = nprims;
-			stride = 1;
-		}else{
-			nworkers = nproc;
-			stride = nprims/nproc;
+		ttask.Commontask = task.Commontask;
+		ttask.q = q;
+		for(i = 0; i < nproc; i++){
+			_ringput(ttaskqs[i], &ttask);
+			_ringflush(ttaskqs[i]);
 		}
+		q = nil;
 
-		for(i = 0; i < nworkers; i++){
-			ttask.eb = eb + i*stride;
-			ttask.ee = i == nworkers-1? ee: ttask.eb + stride;
-			send(ttaskchans[i], &ttask);
-		}
+		if(task.islast && task.job->rctl->doprof)
+			task.job->times.E.t1 = nanosec();
 	}
 }
 
+typedef struct Entsender Entsender;
+struct Entsender
+{
+	Channel		*c;
+	Entitytask	*task;
+};
+
+static void
+sendent(Entity *e, int inside, void *a)
+{
+	Entsender *s;
+
+	s = a;
+	if(!inside && !isentvisible(s->task->job->camera, e))
+		return;
+	s->task->entity = e;
+	send(s->c, s->task);
+}
+
 static void
 renderer(void *arg)
 {
@@ -885,6 +1993,7 @@ renderer(void *arg)
 	Entity *ent;
 	Entityparam *ep;
 	Entitytask task;
+	Entsender es;
 	uvlong lastid;
 
 	threadsetname("renderer");
@@ -903,20 +2012,31 @@ renderer(void *arg)
 
 		job->id = lastid++;
 		sc = job->camera->scene;
-		if(sc->nents < 1){
+		/* with a skybox there's still a background to paint */
+		if(sc->nents < 1 && sc->skybox == nil){
+			_flushclears(job->fb);
 			nbsend(job->donec, nil);
 			continue;
 		}
 
 		if(job->camera->rendopts & ROAbuff)
-			initAbuf(job->fb);
+			initAbuf(job->fb, job->camera->abufcap);
+		else if(job->camera->rendopts & ROKbuff)
+			initKbuf(job->fb);
+		else if(job->camera->rendopts & ROWblend)
+			initWblend(job->fb);
 
 		memset(&task, 0, sizeof task);
 		task.job = job;
-		for(ent = sc->ents.next; ent != &sc->ents; ent = ent->next){
-			task.entity = ent;
-			send(ep->taskc, &task);
-		}
+		if(job->camera->rendopts & ROCull){
+			es.c = ep->taskc;
+			es.task = &task;
+			_bvhcull(sc, job->camera, sendent, &es);
+		}else
+			for(ent = sc->ents.next; ent != &sc->ents; ent = ent->next){
+				task.entity = ent;
+				send(ep->taskc, &task);
+			}
 
 		/* mark end of job */
 		task.islast = 1;
@@ -0,0 +1,157 @@
+#include <u.h>
+#include <libc.h>
+#include <thread.h>
+#include <draw.h>
+#include <memdraw.h>
+#include <geometry.h>
+#include "graphics.h"
+#include "internal.h"
+
+/*
+ * single-producer, single-consumer ring buffers.
+ *
+ * the producer writes ahead of the published tail and makes its
+ * items visible in batches; the consumer takes every published item
+ * it can see at once and gives the slots back in one go.  neither
+ * side takes a lock—when there's nothing to do they fall back to
+ * sleeping on a semaphore, which the other side only touches if it
+ * sees the sleeper's flag raised.
+ *
+ * references:
+ * 	- “Specifying Concurrent Program Modules”, Leslie Lamport, ACM TOPLAS vol. 5, 1983, pp. 190-222
+ * 	- https://www.1024cores.net/home/lock-free-algorithms/queues/unbounded-spsc-queue
+ */
+
+enum {
+	RINGBATCH	= 32,	/* items written before they are published */
+};
+
+static void
+wakeup(Ringwait *w)
+{
+	coherence();
+	if(w->sleeping && cas(&w->sleeping, 1, 0))
+		semrelease(&w->sem, 1);
+}
+
+/*
+ * the flag must be raised before looking at the ring(s) one last
+ * time.  if the waker got there first we still own a token we have
+ * to eat, or the next sleep would return right away.
+ */
+static void
+prepsleep(Ringwait *w)
+{
+	w->sleeping = 1;
+	coherence();
+}
+
+static void
+cancelsleep(Ringwait *w)
+{
+	if(!cas(&w->sleeping, 1, 0))
+		semacquire(&w->sem, 1);
+}
+
+Ring *
+_allocring(ulong n, ulong elemsz, Ringwait *cw)
+{
+	Ring *r;
+	ulong size;
+
+	for(size = 1; size < n; size <<= 1)
+		;
+
+	r = _emalloc(sizeof *r);
+	memset(r, 0, sizeof *r);
+	r->items = _emalloc(size*elemsz);
+	r->mask = size-1;
+	r->elemsz = elemsz;
+	r->cw = cw;
+	return r;
+}
+
+void
+_freering(Ring *r)
+{
+	if(r == nil)
+		return;
+
+	free(r->items);
+	free(r);
+}
+
+void
+_ringflush(Ring *r)
+{
+	if(r->tail == r->ptail)
+		return;
+
+	coherence();	/* items before the tail */
+	r->tail = r->ptail;
+	wakeup(r->cw);
+}
+
+void
+_ringput(Ring *r, void *p)
+{
+	if(r->ptail - r->head > r->mask){
+		_ringflush(r);
+		for(;;){
+			prepsleep(&r->pw);
+			if(r->ptail - r->head <= r->mask){
+				cancelsleep(&r->pw);
+				break;
+			}
+			semacquire(&r->pw.sem, 1);
+		}
+	}
+
+	memmove(r->items + (r->ptail & r->mask)*r->elemsz, p, r->elemsz);
+	if(++r->ptail - r->tail >= RINGBATCH)
+		_ringflush(r);
+}
+
+/*
+ * returns the number of items available for reading in a row, and a
+ * pointer to the first one in *pp.  they remain valid until released.
+ */
+ulong
+_ringget(Ring *r, void **pp)
+{
+	ulong n, i;
+
+	i = r->head & r->mask;
+	n = r->tail - r->head;
+	if(n == 0)
+		return 0;
+	coherence();	/* the tail before its items */
+
+	if(n > r->mask+1 - i)
+		n = r->mask+1 - i;
+	*pp = r->items + i*r->elemsz;
+	return n;
+}
+
+void
+_ringrelease(Ring *r, ulong n)
+{
+	coherence();	/* done with the items before giving them back */
+	r->head += n;
+	wakeup(&r->pw);
+}
+
+/* sleeps until any of the rings has something to read */
+void
+_ringwait(Ringwait *w, Ring **r, int nr)
+{
+	int i;
+
+	prepsleep(w);
+	for(i = 0; i < nr; i++)
+		if(r[i]->tail != r[i]->head){
+			cancelsleep(w);
+			return;
+		}
+	semacquire(&w->sem, 1);
+}
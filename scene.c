@@ -60,6 +60,7 @@ newentity(char *name, Model *m)
 	e->name = name == nil? nil: _estrdup(name);
 	e->mdl = m;
 	e->prev = e->next = nil;
+	e->bvhleaf = -1;
 	return e;
 }
 
@@ -82,6 +83,7 @@ scene_addent(Scene *s, Entity *e)
 	s->ents.prev->next = e;
 	s->ents.prev = e;
 	s->nents++;
+	_bvhinvalidate(s);
 }
 
 static void
@@ -91,6 +93,7 @@ scene_delent(Scene *s, Entity *e)
 	e->next->prev = e->prev;
 	e->prev = e->next = nil;
 	s->nents--;
+	_bvhinvalidate(s);
 }
 
 static Entity *
@@ -110,6 +113,26 @@ scene_addlight(Scene *s, LightSource *l)
 	return bunchadd(s->lights, &l);
 }
 
+/* only tested against the entities' bounding boxes */
+static Entity *
+scene_castray(Scene *s, Point3 o, Point3 d, double *t)
+{
+	return _bvhraycast(s, o, d, t);
+}
+
+static Entity *
+scene_nearestent(Scene *s, Point3 p, double *d)
+{
+	return _bvhnearest(s, p, d);
+}
+
+/* refits e's box now, instead of on the next query */
+static void
+scene_moveent(Scene *s, Entity *e)
+{
+	_bvhrefit(s, e);
+}
+
 Scene *
 newscene(char *name)
 {
@@ -121,10 +144,15 @@ newscene(char *name)
 	s->nents = 0;
 	s->lights = allocbunch(sizeof(LightSource*));
 	s->skybox = nil;
+	memset(&s->bvh, 0, sizeof s->bvh);
+	s->bvh.stale = 1;
 	s->addent = scene_addent;
 	s->delent = scene_delent;
 	s->getent = scene_getent;
 	s->addlight = scene_addlight;
+	s->castray = scene_castray;
+	s->nearestent = scene_nearestent;
+	s->moveent = scene_moveent;
 	return s;
 }
 
@@ -146,6 +174,7 @@ delscene(Scene *s)
 	l = s->lights->items;
 	for(le = l + s->lights->nitems; l < le; l++)
 		dellight(*l);
+	_freebvh(&s->bvh);
 	free(s->name);
 	free(s);
 }
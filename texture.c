@@ -14,73 +14,374 @@ enum {
 	CUBEMAP_FACE_TOP,	/* +y */
 	CUBEMAP_FACE_FRONT,	/* -z */
 	CUBEMAP_FACE_BACK,	/* +z */
+
+	TTBITS		= 2,		/* texels are stored in 4×4 tiles */
+	TTSZ		= 1<<TTBITS,
+	TTMASK		= TTSZ-1,
+};
+
+/*
+ * generated with:
+ * 	% seq 0 255 | awk '{$0 = $0/255; if($0 > 0.04045) $0 = (($0+0.055)/1.055)^2.4; else $0 = $0/12.92; printf("\t%.8f,%s", $0, NR%8 == 0? "\n": "")}'
+ */
+static double srgb2lintab[] = {
+	0.00000000,	0.00030353,	0.00060705,	0.00091058,	0.00121411,	0.00151763,	0.00182116,	0.00212469,
+	0.00242822,	0.00273174,	0.00303527,	0.00334654,	0.00367651,	0.00402472,	0.00439144,	0.00477695,
+	0.00518152,	0.00560539,	0.00604883,	0.00651209,	0.00699541,	0.00749903,	0.00802319,	0.00856813,
+	0.00913406,	0.00972122,	0.01032982,	0.01096009,	0.01161225,	0.01228649,	0.01298303,	0.01370208,
+	0.01444384,	0.01520851,	0.01599629,	0.01680738,	0.01764195,	0.01850022,	0.01938236,	0.02028856,
+	0.02121901,	0.02217388,	0.02315337,	0.02415763,	0.02518686,	0.02624122,	0.02732089,	0.02842604,
+	0.02955683,	0.03071344,	0.03189603,	0.03310477,	0.03433981,	0.03560131,	0.03688945,	0.03820437,
+	0.03954624,	0.04091520,	0.04231141,	0.04373503,	0.04518620,	0.04666509,	0.04817182,	0.04970657,
+	0.05126946,	0.05286065,	0.05448028,	0.05612849,	0.05780543,	0.05951124,	0.06124605,	0.06301002,
+	0.06480327,	0.06662594,	0.06847817,	0.07036010,	0.07227185,	0.07421357,	0.07618538,	0.07818742,
+	0.08021982,	0.08228271,	0.08437621,	0.08650046,	0.08865559,	0.09084171,	0.09305896,	0.09530747,
+	0.09758735,	0.09989873,	0.10224173,	0.10461648,	0.10702310,	0.10946171,	0.11193243,	0.11443537,
+	0.11697067,	0.11953843,	0.12213877,	0.12477182,	0.12743768,	0.13013648,	0.13286832,	0.13563333,
+	0.13843162,	0.14126329,	0.14412847,	0.14702727,	0.14995979,	0.15292615,	0.15592646,	0.15896084,
+	0.16202938,	0.16513219,	0.16826940,	0.17144110,	0.17464740,	0.17788842,	0.18116424,	0.18447499,
+	0.18782077,	0.19120168,	0.19461783,	0.19806932,	0.20155625,	0.20507874,	0.20863687,	0.21223076,
+	0.21586050,	0.21952620,	0.22322796,	0.22696587,	0.23074005,	0.23455058,	0.23839757,	0.24228112,
+	0.24620133,	0.25015828,	0.25415209,	0.25818285,	0.26225066,	0.26635560,	0.27049779,	0.27467731,
+	0.27889426,	0.28314874,	0.28744084,	0.29177065,	0.29613827,	0.30054379,	0.30498731,	0.30946892,
+	0.31398871,	0.31854678,	0.32314321,	0.32777810,	0.33245154,	0.33716362,	0.34191442,	0.34670406,
+	0.35153260,	0.35640014,	0.36130678,	0.36625260,	0.37123768,	0.37626212,	0.38132601,	0.38642943,
+	0.39157248,	0.39675523,	0.40197778,	0.40724021,	0.41254261,	0.41788507,	0.42326767,	0.42869050,
+	0.43415364,	0.43965717,	0.44520119,	0.45078578,	0.45641102,	0.46207700,	0.46778380,	0.47353150,
+	0.47932018,	0.48514994,	0.49102085,	0.49693300,	0.50288646,	0.50888132,	0.51491767,	0.52099557,
+	0.52711513,	0.53327640,	0.53947949,	0.54572446,	0.55201140,	0.55834039,	0.56471151,	0.57112483,
+	0.57758044,	0.58407842,	0.59061884,	0.59720179,	0.60382734,	0.61049557,	0.61720656,	0.62396039,
+	0.63075714,	0.63759687,	0.64447968,	0.65140564,	0.65837482,	0.66538730,	0.67244316,	0.67954247,
+	0.68668531,	0.69387176,	0.70110189,	0.70837578,	0.71569350,	0.72305513,	0.73046074,	0.73791041,
+	0.74540421,	0.75294222,	0.76052450,	0.76815115,	0.77582222,	0.78353779,	0.79129794,	0.79910274,
+	0.80695226,	0.81484657,	0.82278575,	0.83076988,	0.83879901,	0.84687323,	0.85499261,	0.86315721,
+	0.87136712,	0.87962240,	0.88792312,	0.89626935,	0.90466117,	0.91309865,	0.92158186,	0.93011086,
+	0.93868573,	0.94730654,	0.95597335,	0.96468625,	0.97344529,	0.98225055,	0.99110210,	1.00000000,
 };
 
+/*
+ * brings the texel coordinate i back into [0,n) according to
+ * the wrap mode.  powers of two repeat with a mask.
+ */
+static int
+wrap(int i, int n, int mode)
+{
+	switch(mode){
+	case TWRepeat:
+		if((n & n-1) == 0)
+			return i & n-1;
+		i %= n;
+		return i < 0? i+n: i;
+	case TWMirror:
+		if((n & n-1) == 0)
+			i &= 2*n-1;
+		else{
+			i %= 2*n;
+			if(i < 0)
+				i += 2*n;
+		}
+		return i < n? i: 2*n-1 - i;
+	}
+	return i < 0? 0: i >= n? n-1: i;
+}
+
 /*
  * uv-coords belong to the 1st quadrant (v grows bottom-up),
  * hence the need to reverse the v coord.
  */
 static Point
-uv2tp(Point2 uv, Texture *t)
+uv2tp(Point2 uv, Texmip *m, int mode)
 {
-	uv.x = fclamp(uv.x, 0, 1);
-	uv.y = fclamp(uv.y, 0, 1);
-	return Pt(uv.x*Dx(t->image->r), (1 - uv.y)*Dy(t->image->r));
+	return Pt(
+		wrap(floor(uv.x*m->w), m->w, mode),
+		wrap(floor((1 - uv.y)*m->h), m->h, mode));
 }
 
-#define divalpha1(a, v)		((((v)<<8)-(v))/(a))
+/*
+ * the tiles are laid out row by row, and so are the texels
+ * within each of them.  neighbours along v are then at most a
+ * tile away, instead of a whole row of the image.
+ */
+static ushort *
+texeladdr(Texmip *m, int x, int y)
+{
+	return m->texels + 4*((((y>>TTBITS)*m->tw + (x>>TTBITS))<<2*TTBITS) + ((y&TTMASK)<<TTBITS) + (x&TTMASK));
+}
+
+static usize
+mipsize(Texmip *m, int storage)
+{
+	usize ntiles;
+
+	ntiles = (usize)m->tw*((m->h + TTMASK)>>TTBITS);
+	switch(storage){
+	case TSBC1: return ntiles*8;
+	case TSBC3: return ntiles*16;
+	}
+	return ntiles*TTSZ*TTSZ*4*sizeof(ushort);
+}
+
+static void
+allocmip(Texmip *m, int w, int h)
+{
+	m->w = w;
+	m->h = h;
+	m->tw = (w + TTMASK)>>TTBITS;
+	m->texels = _emalloc(mipsize(m, TSRGBA16));
+}
 
 static ulong
-divalpha(ulong c)
+getle(uchar *b, int n)
+{
+	ulong v;
+
+	for(v = 0; n-- > 0;)
+		v = v<<8 | b[n];
+	return v;
+}
+
+static void
+putle(uchar *b, uvlong v, int n)
+{
+	for(; n-- > 0; v >>= 8)
+		*b++ = v;
+}
+
+static void
+unpack565(uchar c[3], ulong v)
+{
+	c[0] = v>>11 & 0x1F;
+	c[1] = v>>5 & 0x3F;
+	c[2] = v & 0x1F;
+	c[0] = c[0]<<3 | c[0]>>2;
+	c[1] = c[1]<<2 | c[1]>>4;
+	c[2] = c[2]<<3 | c[2]>>2;
+}
+
+/*
+ * decodes texel i of a BC1 color block.  the ones following a
+ * BC3 alpha block are always in four-color mode.
+ */
+static void
+bc1texel(uchar c[4], uchar *b, int i, int fourcolor)
 {
-	ushort r, g, b, a;
+	uchar c0[3], c1[3];
+	ulong v0, v1;
+	int j, idx;
+
+	v0 = getle(b, 2);
+	v1 = getle(b+2, 2);
+	idx = getle(b+4, 4) >> 2*i & 3;
+	unpack565(c0, v0);
+	unpack565(c1, v1);
+	fourcolor |= v0 > v1;
+
+	c[3] = 0xFF;
+	for(j = 0; j < 3; j++)
+		switch(idx){
+		case 0: c[j] = c0[j]; break;
+		case 1: c[j] = c1[j]; break;
+		case 2: c[j] = fourcolor? (2*c0[j] + c1[j])/3: (c0[j] + c1[j])/2; break;
+		case 3:
+			if(fourcolor)
+				c[j] = (c0[j] + 2*c1[j])/3;
+			else
+				c[j] = c[3] = 0;
+			break;
+		}
+}
 
-	a = c     & 0xff;
-	b = c>>8  & 0xff;
-	g = c>>16 & 0xff;
-	r = c>>24 & 0xff;
-	r = divalpha1(a, r);
-	g = divalpha1(a, g);
-	b = divalpha1(a, b);
-	return (r<<24)|(g<<16)|(b<<8)|a;
+static uchar
+bc3alpha(uchar *b, int i)
+{
+	int a0, a1, idx;
+
+	a0 = b[0];
+	a1 = b[1];
+	idx = (getle(b+2, 3) | (uvlong)getle(b+5, 3)<<24) >> 3*i & 7;
+	switch(idx){
+	case 0: return a0;
+	case 1: return a1;
+	}
+	if(a0 > a1)
+		return ((8-idx)*a0 + (idx-1)*a1)/7;
+	switch(idx){
+	case 6: return 0;
+	case 7: return 0xFF;
+	}
+	return ((6-idx)*a0 + (idx-1)*a1)/5;
 }
 
 static Color
-memreadcolor(Texture *t, Point sp)
-{
-	union {
-		uchar b[4];
-		ulong c;
-	} cbuf;
-
-	switch(t->image->chan){
-	default: sysfatal("unsupported texture format");
-	case RGB24:
-		unloadmemimage(t->image, rectaddpt(UR, sp), cbuf.b+1, sizeof cbuf - 1);
-		cbuf.b[0] = 0xFF;
-		break;
-	case RGBA32:
-		unloadmemimage(t->image, rectaddpt(UR, sp), cbuf.b, sizeof cbuf);
-		break;
-	case XRGB32:
-		unloadmemimage(t->image, rectaddpt(UR, sp), cbuf.b, sizeof cbuf);
-		memmove(cbuf.b+1, cbuf.b, 3);
-		cbuf.b[0] = 0xFF;
-		break;
-	case GREY8:
-		unloadmemimage(t->image, rectaddpt(UR, sp), cbuf.b+1, 1);
-		memset(cbuf.b+2, cbuf.b[1], 2);
-		cbuf.b[0] = 0xFF;
-		break;
+texel(Texture *t, Texmip *m, Point p)
+{
+	static double k = 1.0/0xFFFF;
+	ushort *c;
+	uchar *b, bc[4];
+	int i;
+
+	if(t->storage == TSRGBA16){
+		c = texeladdr(m, p.x, p.y);
+		return (Color){c[0]*k, c[1]*k, c[2]*k, c[3]*k};
 	}
-	/* remove pre-multiplied alpha */
-	if(hasalpha(t->image->chan) && cbuf.b[0] != 0)
-		cbuf.c = divalpha(cbuf.c);
+
+	b = m->blocks + ((p.y>>TTBITS)*m->tw + (p.x>>TTBITS))*(t->storage == TSBC3? 16: 8);
+	i = (p.y&TTMASK)<<TTBITS | (p.x&TTMASK);
+	if(t->storage == TSBC3){
+		bc1texel(bc, b+8, i, 1);
+		bc[3] = bc3alpha(b, i);
+	}else
+		bc1texel(bc, b, i, 0);
 
 	if(t->type == sRGBTexture)
-		cbuf.c = srgb2linearul(cbuf.c);
+		return (Color){srgb2lintab[bc[0]], srgb2lintab[bc[1]], srgb2lintab[bc[2]], bc[3]/255.0};
+	return (Color){bc[0]/255.0, bc[1]/255.0, bc[2]/255.0, bc[3]/255.0};
+}
+
+/*
+ * the four texels around uv, weighted by how close their
+ * centers are to it.
+ */
+static Color
+bilinear(Texture *t, Texmip *m, Point2 uv)
+{
+	Color c0, c1;
+	double x, y, fx, fy;
+	int x0, x1, y0, y1;
+
+	x = uv.x*m->w - 0.5;
+	y = (1 - uv.y)*m->h - 0.5;
+	x0 = floor(x);
+	y0 = floor(y);
+	fx = x - x0;
+	fy = y - y0;
+
+	x1 = wrap(x0+1, m->w, t->wrap);
+	y1 = wrap(y0+1, m->h, t->wrap);
+	x0 = wrap(x0, m->w, t->wrap);
+	y0 = wrap(y0, m->h, t->wrap);
+
+	c0 = lerp3(texel(t, m, Pt(x0, y0)), texel(t, m, Pt(x1, y0)), fx);
+	c1 = lerp3(texel(t, m, Pt(x0, y1)), texel(t, m, Pt(x1, y1)), fx);
+	return lerp3(c0, c1, fy);
+}
+
+/*
+ * converts the image into the samplers' layout once: straight
+ * alpha RGBA with 16 bits per channel, linearized if it's sRGB.
+ */
+static void
+decodetexture(Texture *t, Texmip *m, Memimage *src)
+{
+	Memimage *i;
+	ushort lintab[256], *tp;
+	uchar *buf, *bp;
+	ulong a, c, j;
+	usize n;
+	int x, y;
+
+	i = src;
+	if(i->chan != RGBA32){
+		i = _eallocmemimage(src->r, RGBA32);
+		memimagedraw(i, i->r, src, src->r.min, nil, ZP, S);
+	}
+
+	for(j = 0; j < nelem(lintab); j++)
+		lintab[j] = (t->type == sRGBTexture? srgb2lintab[j]: j/255.0)*0xFFFF + 0.5;
+
+	allocmip(m, Dx(i->r), Dy(i->r));
+	n = (usize)m->w*m->h;
+	buf = _emalloc(n*4);
+	if(unloadmemimage(i, i->r, buf, n*4) < 0)
+		sysfatal("unloadmemimage: %r");
+
+	/* RGBA32 is a, b, g, r in memory */
+	bp = buf;
+	for(y = 0; y < m->h; y++)
+	for(x = 0; x < m->w; x++, bp += 4){
+		tp = texeladdr(m, x, y);
+		a = bp[0];
+		for(j = 0; j < 3; j++){
+			c = bp[3-j];
+			/* remove pre-multiplied alpha */
+			if(a != 0 && a != 0xFF)
+				c = min((c*0xFF + a/2)/a, 0xFF);
+			tp[j] = lintab[c];
+		}
+		tp[3] = a*0x101;
+	}
+
+	free(buf);
+	if(i != src)
+		freememimage(i);
+}
+
+/*
+ * halves the previous level with a box filter.  colors are
+ * weighted by their alpha, so transparent texels don't bleed
+ * into the opaque ones.
+ */
+static void
+downsample(Texmip *d, Texmip *s)
+{
+	ushort *sp[4], *dp;
+	uvlong c[3], a;
+	int x, y, i, j;
+
+	allocmip(d, max(s->w/2, 1), max(s->h/2, 1));
+
+	for(y = 0; y < d->h; y++)
+	for(x = 0; x < d->w; x++){
+		dp = texeladdr(d, x, y);
+		sp[0] = texeladdr(s, min(2*x, s->w-1), min(2*y, s->h-1));
+		sp[1] = texeladdr(s, min(2*x+1, s->w-1), min(2*y, s->h-1));
+		sp[2] = texeladdr(s, min(2*x, s->w-1), min(2*y+1, s->h-1));
+		sp[3] = texeladdr(s, min(2*x+1, s->w-1), min(2*y+1, s->h-1));
+
+		c[0] = c[1] = c[2] = a = 0;
+		for(i = 0; i < 4; i++){
+			a += sp[i][3];
+			for(j = 0; j < 3; j++)
+				c[j] += (uvlong)sp[i][j]*sp[i][3];
+		}
+		for(j = 0; j < 3; j++)
+			if(a != 0)
+				dp[j] = (c[j] + a/2)/a;
+			else
+				dp[j] = (sp[0][j] + sp[1][j] + sp[2][j] + sp[3][j] + 2)/4;
+		dp[3] = (a + 2)/4;
+	}
+}
 
-	return ul2col(cbuf.c);
+static void
+mkmipchain(Texture *t, Memimage *src)
+{
+	int n, w, h;
+
+	for(n = 1, w = Dx(src->r), h = Dy(src->r); w > 1 || h > 1; n++){
+		w = max(w/2, 1);
+		h = max(h/2, 1);
+	}
+
+	t->mip = _emalloc(n*sizeof(Texmip));
+	t->nmip = n;
+	decodetexture(t, &t->mip[0], src);
+	for(n = 1; n < t->nmip; n++)
+		downsample(&t->mip[n], &t->mip[n-1]);
+}
+
+static void
+freemipchain(Texture *t)
+{
+	int i;
+
+	for(i = 0; i < t->nmip; i++){
+		free(t->mip[i].texels);
+		free(t->mip[i].blocks);
+	}
+	free(t->mip);
+	t->mip = nil;
+	t->nmip = 0;
 }
 
 /*
@@ -89,7 +390,7 @@ memreadcolor(Texture *t, Point sp)
 Color
 neartexsampler(Texture *t, Point2 uv)
 {
-	return memreadcolor(t, uv2tp(uv, t));
+	return texel(t, &t->mip[0], uv2tp(uv, &t->mip[0], t->wrap));
 }
 
 /*
@@ -98,26 +399,39 @@ neartexsampler(Texture *t, Point2 uv)
 Color
 bilitexsampler(Texture *t, Point2 uv)
 {
-	Rectangle r;
-	Color c1, c2;
-
-	r = rectaddpt(UR, uv2tp(uv, t));
-	if(r.min.x < t->image->r.min.x){
-		r.min.x++;
-		r.max.x++;
-	}else if(r.min.y < t->image->r.min.y){
-		r.min.y++;
-		r.max.y++;
-	}else if(r.max.x >= t->image->r.max.x){
-		r.min.x--;
-		r.max.x--;
-	}else if(r.max.y >= t->image->r.max.y){
-		r.min.y--;
-		r.max.y--;
-	}
-	c1 = lerp3(memreadcolor(t, r.min), memreadcolor(t, Pt(r.max.x, r.min.y)), 0.5);
-	c2 = lerp3(memreadcolor(t, Pt(r.min.x, r.max.y)), memreadcolor(t, r.max), 0.5);
-	return lerp3(c1, c2, 0.5);
+	return bilinear(t, &t->mip[0], uv);
+}
+
+/*
+ * trilinear sampler
+ *
+ * the level of detail comes from the uv derivatives along x and
+ * y (see Shaderparams), and the two closest mip levels are
+ * sampled bilinearly and blended.
+ *
+ * references:
+ * 	- “Pyramidal Parametrics”, Lance Williams, SIGGRAPH '83, pp. 1-11
+ * 	- “OpenGL ES 2.0 Specification”, § 3.7.7 Texture Minification
+ */
+Color
+tritexsampler(Texture *t, Point2 uv, Point2 duvdx, Point2 duvdy)
+{
+	Color c0, c1;
+	double ρx, ρy, lod;
+	int l;
+
+	ρx = hypot(duvdx.x*t->mip[0].w, duvdx.y*t->mip[0].h);
+	ρy = hypot(duvdy.x*t->mip[0].w, duvdy.y*t->mip[0].h);
+	lod = log(max(ρx, ρy))/log(2);
+	if(!(lod > 0))		/* magnified, or no derivatives (NaN) */
+		return bilinear(t, &t->mip[0], uv);
+	if(lod >= t->nmip-1)
+		return bilinear(t, &t->mip[t->nmip-1], uv);
+
+	l = lod;
+	c0 = bilinear(t, &t->mip[l], uv);
+	c1 = bilinear(t, &t->mip[l+1], uv);
+	return lerp3(c0, c1, lod - l);
 }
 
 Color
@@ -126,6 +440,197 @@ sampletexture(Texture *t, Point2 uv, Color(*sampler)(Texture*,Point2))
 	return sampler(t, uv);
 }
 
+/*
+ * for fragment shaders: samples trilinearly, picking the mip
+ * levels with the fragment's own uv derivatives.
+ */
+Color
+fsampletexture(Shaderparams *sp, Texture *t, Point2 uv)
+{
+	return tritexsampler(t, uv, sp->duvdx, sp->duvdy);
+}
+
+static int
+pack565(int c[3])
+{
+	return (c[0]*31 + 127)/255 << 11 | (c[1]*63 + 127)/255 << 5 | (c[2]*31 + 127)/255;
+}
+
+static int
+dist2(uchar *a, uchar *b)
+{
+	int d, i, r;
+
+	for(r = i = 0; i < 3; i++){
+		d = a[i] - b[i];
+		r += d*d;
+	}
+	return r;
+}
+
+/*
+ * fits the colors to the diagonal of their bounding box that
+ * follows them best, slightly inset, and picks the closest of
+ * the four palette entries for each texel.
+ */
+static void
+encodebc1(uchar *b, uchar px[16][4])
+{
+	uchar pal[4][3], c[4];
+	int lo[3], hi[3], mean[3], cov[3];
+	int i, j, k, v0, v1, inset, d, best, bestd;
+	ulong idx;
+
+	for(j = 0; j < 3; j++){
+		lo[j] = 0xFF;
+		hi[j] = mean[j] = cov[j] = 0;
+		for(i = 0; i < 16; i++){
+			lo[j] = min(lo[j], px[i][j]);
+			hi[j] = max(hi[j], px[i][j]);
+			mean[j] += px[i][j];
+		}
+		mean[j] /= 16;
+	}
+	/* flip the green and blue ranges if they go against red's */
+	for(i = 0; i < 16; i++)
+		for(j = 1; j < 3; j++)
+			cov[j] += (px[i][0] - mean[0])*(px[i][j] - mean[j]);
+	for(j = 0; j < 3; j++){
+		inset = (hi[j] - lo[j])/16;
+		lo[j] += inset;
+		hi[j] -= inset;
+		if(cov[j] < 0)
+			SWAP(int, &lo[j], &hi[j]);
+	}
+
+	v0 = pack565(hi);
+	v1 = pack565(lo);
+	if(v0 < v1)
+		SWAP(int, &v0, &v1);
+	putle(b, v0, 2);
+	putle(b+2, v1, 2);
+	if(v0 == v1){
+		putle(b+4, 0, 4);
+		return;
+	}
+
+	for(k = 0; k < 4; k++){
+		putle(b+4, k, 4);
+		bc1texel(c, b, 0, 1);
+		memmove(pal[k], c, 3);
+	}
+
+	idx = 0;
+	for(i = 0; i < 16; i++){
+		best = 0;
+		bestd = dist2(px[i], pal[0]);
+		for(k = 1; k < 4; k++)
+			if((d = dist2(px[i], pal[k])) < bestd){
+				best = k;
+				bestd = d;
+			}
+		idx |= (ulong)best << 2*i;
+	}
+	putle(b+4, idx, 4);
+}
+
+static void
+encodebc3alpha(uchar *b, uchar px[16][4])
+{
+	uvlong idx;
+	int i, k, a0, a1, d, best, bestd;
+
+	a0 = 0;
+	a1 = 0xFF;
+	for(i = 0; i < 16; i++){
+		a0 = max(a0, px[i][3]);
+		a1 = min(a1, px[i][3]);
+	}
+	b[0] = a0;
+	b[1] = a1;
+
+	idx = 0;
+	if(a0 > a1)
+		for(i = 0; i < 16; i++){
+			best = 0;
+			bestd = 0x100;
+			for(k = 0; k < 8; k++){
+				putle(b+2, (uvlong)k, 6);
+				d = abs(bc3alpha(b, 0) - px[i][3]);
+				if(d < bestd){
+					best = k;
+					bestd = d;
+				}
+			}
+			idx |= (uvlong)best << 3*i;
+		}
+	putle(b+2, idx, 6);
+}
+
+/*
+ * replaces the decoded texels of every mip level with BC1 blocks
+ * (4 bits per texel), or BC3 (8 bits per texel) if the texture
+ * has any transparency.  the blocks are kept in the same tile
+ * order, and decoded on the fly by the samplers.  the source
+ * image is left alone, so exports stay lossless.
+ *
+ * references:
+ * 	- “S3 Texture Compression”, EXT_texture_compression_s3tc, OpenGL Registry
+ * 	- “Real-Time DXT Compression”, J.M.P. van Waveren, Intel/id Software, 2006
+ */
+void
+compresstexture(Texture *t)
+{
+	uchar lin2tab[4096], px[16][4], *b;
+	ushort *c;
+	Texmip *m;
+	double v;
+	int i, j, l, x, y, tx, ty, bsz;
+
+	if(t->storage != TSRGBA16 || t->nmip < 1)
+		return;
+
+	/* back to the texture's own encoding, 8 bits per channel */
+	for(i = 0; i < nelem(lin2tab); i++){
+		v = i/(double)(nelem(lin2tab)-1);
+		if(t->type == sRGBTexture)
+			v = v > 0.0031308? 1.055*pow(v, 1/2.4) - 0.055: 12.92*v;
+		lin2tab[i] = v*0xFF + 0.5;
+	}
+
+	t->storage = TSBC1;
+	m = &t->mip[0];
+	for(y = 0; y < m->h && t->storage == TSBC1; y++)
+	for(x = 0; x < m->w; x++)
+		if(texeladdr(m, x, y)[3] != 0xFFFF){
+			t->storage = TSBC3;
+			break;
+		}
+	bsz = t->storage == TSBC3? 16: 8;
+
+	for(l = 0; l < t->nmip; l++){
+		m = &t->mip[l];
+		m->blocks = _emalloc(mipsize(m, t->storage));
+		b = m->blocks;
+		for(ty = 0; ty < m->h; ty += TTSZ)
+		for(tx = 0; tx < m->w; tx += TTSZ, b += bsz){
+			for(i = 0; i < 16; i++){
+				c = texeladdr(m, min(tx + (i&TTMASK), m->w-1), min(ty + (i>>TTBITS), m->h-1));
+				for(j = 0; j < 3; j++)
+					px[i][j] = lin2tab[c[j]>>4];
+				px[i][3] = c[3]>>8;
+			}
+			if(t->storage == TSBC3){
+				encodebc3alpha(b, px);
+				encodebc1(b+8, px);
+			}else
+				encodebc1(b, px);
+		}
+		free(m->texels);
+		m->texels = nil;
+	}
+}
+
 Texture *
 alloctexture(int type, Memimage *i)
 {
@@ -135,6 +640,8 @@ alloctexture(int type, Memimage *i)
 	memset(t, 0, sizeof *t);
 	t->image = i;
 	t->type = type;
+	if(i != nil)
+		mkmipchain(t, i);
 	incref(t);
 	return t;
 }
@@ -150,9 +657,29 @@ Texture *
 duptexture(Texture *t)
 {
 	Texture *n;
+	Texmip *m;
+	int i;
 
 	n = alloctexture(t->type, nil);
 	n->image = dupmemimage(t->image);
+	n->wrap = t->wrap;
+	n->storage = t->storage;
+	if(t->nmip > 0){
+		n->mip = _emalloc(t->nmip*sizeof(Texmip));
+		n->nmip = t->nmip;
+		for(i = 0; i < n->nmip; i++){
+			m = &n->mip[i];
+			*m = t->mip[i];
+			if(m->texels != nil){
+				m->texels = _emalloc(mipsize(m, TSRGBA16));
+				memmove(m->texels, t->mip[i].texels, mipsize(m, TSRGBA16));
+			}
+			if(m->blocks != nil){
+				m->blocks = _emalloc(mipsize(m, t->storage));
+				memmove(m->blocks, t->mip[i].blocks, mipsize(m, t->storage));
+			}
+		}
+	}
 	return n;
 }
 
@@ -164,6 +691,7 @@ freetexture(Texture *t)
 
 	if(decref(t) == 0){
 		freememimage(t->image);
+		freemipchain(t);
 		free(t);
 	}
 }
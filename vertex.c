@@ -104,6 +104,26 @@ _addvertex(BVertex *a, BVertex *b)
 	}
 }
 
+/* a += b·s */
+void
+_maddvertex(BVertex *a, BVertex *b, double s)
+{
+	Vertexattr *va, *vb, *ve;
+
+	a->p = addpt3(a->p, mulpt3(b->p, s));
+	a->n = addpt3(a->n, mulpt3(b->n, s));
+	a->c = addpt3(a->c, mulpt3(b->c, s));
+	a->uv = addpt2(a->uv, mulpt2(b->uv, s));
+	a->tangent = addpt3(a->tangent, mulpt3(b->tangent, s));
+	ve = a->attrs + a->nattrs;
+	for(va = a->attrs, vb = b->attrs; va < ve; va++, vb++){
+		if(va->type == VAPoint)
+			va->p = addpt3(va->p, mulpt3(vb->p, s));
+		else
+			va->n += vb->n*s;
+	}
+}
+
 /*
  * this is only used for attribute linearization and subsequent
  * perspective correction, so we can omit the position.